@@ -1,29 +1,21 @@
 #pragma once
 
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
 #include "string.h"
 #include "stdio.h"
 #include "malloc.h"
 #include "../byte_file.h"
-#include "../set/set.h"
+#include "frequency_table.h"
 
-typedef struct {
-    const char *ip;
-    int frequency;
-    int length;
-} bytecode;
-
-int bytecode_comparator(void *ut1, void *ut2) {
-    bytecode *bytecode1 = (bytecode *) ut1;
-    bytecode *bytecode2 = (bytecode *) ut2;
-    return !memcmp(bytecode1->ip, bytecode2->ip, bytecode1->length) && bytecode1->length == bytecode2->length;
-}
-
-int frequency_comparator(const bytecode *bytecode1, const bytecode *bytecode2) {
-    return bytecode2->frequency - bytecode1->frequency;
+int frequency_comparator(const frequency_entry *entry1, const frequency_entry *entry2) {
+    return entry2->frequency - entry1->frequency;
 }
 
 int empty_printer(FILE *f, const char *value, ...) {
+    (void) f;
+    (void) value;
     return 0;
 }
 
@@ -39,7 +31,7 @@ const char *analyze_bytecode(FILE *f, byte_file *byteFile, const char *ip, int (
     bytecode_type bc_type = get_bytecode_type(bytecode);
     switch (high_bits(bytecode)) {
         case BINOP_HIGH_BITS:
-            printer(f, "BINOP\t%s", binop_types[low_bits(bytecode)]);
+            printer(f, "BINOP\t%s", binop_types[low_bits(bytecode) - 1]);
             return ip;
         case LD_HIGH_BITS:
         case LDA_HIGH_BITS:
@@ -63,7 +55,7 @@ const char *analyze_bytecode(FILE *f, byte_file *byteFile, const char *ip, int (
             }
             return ip;
         case PATT_HIGH_BITS:
-            printer(f, "PATT\t%s\n", patt_types[low_bits(bytecode)]);
+            printer(f, "PATT\t%s", patt_types[low_bits(bytecode)]);
             return ip;
         case 0xF:
             printer(f, "STOP");
@@ -214,49 +206,178 @@ const char *analyze_bytecode(FILE *f, byte_file *byteFile, const char *ip, int (
 
 void analyze_bytecode_frequency(FILE *f, byte_file *byteFile) {
     const char *ip = byteFile->code_ptr;
-    struct set *s = set_init();
-    struct adt_funcs adt;
-    adt.ptr_equality = bytecode_comparator;
-    set_add_adt(s, &adt, USER_DEFINED);
+    frequency_table *table = frequency_table_init();
     while (ip < byteFile->code_ptr + byteFile->bytecode_size) {
-        bytecode *bc = malloc(sizeof(bytecode));
-        if (bc == NULL) {
-            failure("Severity ERROR: Can't allocate memory.\n");
-        }
         const char *next_ip = analyze_bytecode(f, byteFile, ip, &empty_printer);
-        bc->ip = ip;
-        bc->length = next_ip - ip;
+        frequency_table_count(table, ip, next_ip - ip, ip, 1);
         ip = next_ip;
-        struct node *n = find_node(s, (void *) bc, USER_DEFINED);
-        if (n != NULL) {
-            bytecode *existed_bc = (bytecode *) node_get_data(n);
-            existed_bc->frequency++;
-            free(bc);
-        } else {
-            bc->frequency = 1;
-            set_add(s, (void *) bc, USER_DEFINED);
+    }
+
+    frequency_entry *bytecodes = frequency_table_entries(table);
+    qsort(bytecodes, table->num, sizeof(frequency_entry), (__compar_fn_t) frequency_comparator);
+    for (u_int32_t i = 0; i < table->num; ++i) {
+        fprintf(f, "%d occurrences of bytecode: \"", bytecodes[i].frequency);
+        analyze_bytecode(f, byteFile, bytecodes[i].ip, &fprintf);
+        fprintf(f, "\"\n");
+    }
+    free(bytecodes);
+    frequency_table_free(table);
+}
+
+// prints every instruction with its code offset, the targets of jumps and calls are offsets too
+void dump_bytecode(FILE *f, byte_file *byteFile) {
+    const char *ip = byteFile->code_ptr;
+    while (ip < byteFile->code_ptr + byteFile->bytecode_size) {
+        fprintf(f, "0x%.8x:\t", (u_int32_t) (ip - byteFile->code_ptr));
+        ip = analyze_bytecode(f, byteFile, ip, &fprintf);
+        fprintf(f, "\n");
+    }
+}
+
+// every occurrence of a sequence saves (size - 1) dispatches when the sequence is fused into one instruction
+static inline int dispatch_savings(const frequency_entry *sequence) {
+    return sequence->frequency * (sequence->size - 1);
+}
+
+int savings_comparator(const frequency_entry *sequence1, const frequency_entry *sequence2) {
+    return dispatch_savings(sequence2) - dispatch_savings(sequence1);
+}
+
+// formats of analyze_bytecode that print string table operands
+static const char *const string_operand_formats[] = {"STRING\t%s", "SEXP\t%s ", "TAG\t%s "};
+
+// prints the opcode of the instruction at ip without its operands
+int opcode_printer(FILE *f, const char *value, ...) {
+    va_list args;
+    va_start(args, value);
+    for (const char *c = value; *c; ++c) {
+        if (*c != '%') {
+            fputc(*c, f);
+            continue;
         }
+        while (!strchr("dxs", *c)) {
+            ++c;
+        }
+        const char *argument = *c == 's' ? va_arg(args, const char *) : (va_arg(args, int), "*");
+        // other strings (binop, pattern and location kinds) are encoded in the opcode itself
+        for (size_t i = 0; i < sizeof(string_operand_formats) / sizeof(char *); ++i) {
+            if (strcmp(value, string_operand_formats[i]) == 0) {
+                argument = "*";
+            }
+        }
+        fputs(argument, f);
+    }
+    va_end(args);
+    return 0;
+}
+
+static bool ends_basic_block(u_int8_t bytecode) {
+    switch (bytecode) {
+        case JMP:
+        case CJMP_Z:
+        case CJMP_NZ:
+        case END:
+        case RET:
+        case FAIL:
+        case CALL:
+        case CALLC:
+            return true;
+        default:
+            return high_bits(bytecode) == 0xF;
     }
+}
 
-    bytecode *bytecodes = malloc(s->num * sizeof(bytecode));
-    if (bytecodes == NULL) {
+// marks the offsets of the first instructions of basic blocks
+static bool *find_basic_block_leaders(byte_file *byteFile) {
+    const char *code_end = byteFile->code_ptr + byteFile->bytecode_size;
+    bool *leaders = calloc(byteFile->bytecode_size + 1, sizeof(bool));
+    if (leaders == NULL) {
         failure("Severity ERROR: Can't allocate memory.\n");
     }
+    for (const char *ip = byteFile->code_ptr; ip < code_end;) {
+        u_int8_t bytecode = *ip;
+        const char *next_ip = analyze_bytecode(stdout, byteFile, ip, &empty_printer);
+        if (bytecode == JMP || bytecode == CJMP_Z || bytecode == CJMP_NZ) {
+            u_int32_t target = *(u_int32_t *) (ip + 1);
+            if (target < byteFile->bytecode_size) {
+                leaders[target] = true;
+            }
+        }
+        if (get_bytecode_type(bytecode) == BEGIN) {
+            leaders[ip - byteFile->code_ptr] = true;
+        }
+        if (ends_basic_block(bytecode)) {
+            leaders[next_ip - byteFile->code_ptr] = true;
+        }
+        ip = next_ip;
+    }
+    return leaders;
+}
 
-    struct node *n;
-    int i = 0;
-    for (n = set_first(s); set_done(s); n = set_next(s)) {
-        bytecode *set_bc = (bytecode *) node_get_data(n);
-        bytecode bc = {.ip = set_bc->ip, .frequency = set_bc->frequency, .length = set_bc->length};
-        bytecodes[i++] = bc;
+static void count_sequence(frequency_table *table, const char **window, int size, bool operand_sensitive) {
+    if (operand_sensitive) {
+        frequency_table_count(table, window[0], window[size] - window[0], window[0], size);
+        return;
     }
+    char opcodes[3];
+    for (int i = 0; i < size; ++i) {
+        opcodes[i] = *window[i];
+    }
+    frequency_table_count(table, opcodes, size, window[0], size);
+}
 
-    qsort(bytecodes, s->num, sizeof(bytecode), (__compar_fn_t) frequency_comparator);
-    for (int i = 0; i < s->num; ++i) {
-        fprintf(f, "%d occurrences of bytecode: \"", bytecodes[i].frequency);
-        analyze_bytecode(f, byteFile, bytecodes[i].ip, &fprintf);
+static void print_sequences(FILE *f, byte_file *byteFile, frequency_table *table, bool operand_sensitive) {
+    frequency_entry *sequences = frequency_table_entries(table);
+    qsort(sequences, table->num, sizeof(frequency_entry), (__compar_fn_t) savings_comparator);
+    for (u_int32_t i = 0; i < table->num; ++i) {
+        fprintf(f, "%d dispatches saved by %d occurrences of sequence: \"", dispatch_savings(&sequences[i]),
+                sequences[i].frequency);
+        const char *ip = sequences[i].ip;
+        for (int j = 0; j < sequences[i].size; ++j) {
+            if (j > 0) {
+                fprintf(f, "; ");
+            }
+            ip = analyze_bytecode(f, byteFile, ip, operand_sensitive ? &fprintf : &opcode_printer);
+        }
         fprintf(f, "\"\n");
     }
-    free(bytecodes);
-    set_free(s);
+    free(sequences);
+}
+
+// counts pairs and triples of instructions inside basic blocks, ranked by the dispatches saved by fusing them
+void analyze_bytecode_sequences(FILE *f, byte_file *byteFile) {
+    const char *code_end = byteFile->code_ptr + byteFile->bytecode_size;
+    bool *leaders = find_basic_block_leaders(byteFile);
+    frequency_table *tables[2] = {frequency_table_init(), frequency_table_init()};
+
+    // window holds up to three last instructions of the current basic block and the start of the next one
+    const char *window[4];
+    int window_size = 0;
+    for (const char *ip = byteFile->code_ptr; ip < code_end;) {
+        if (leaders[ip - byteFile->code_ptr] || window_size == 3) {
+            if (leaders[ip - byteFile->code_ptr]) {
+                window_size = 0;
+            } else {
+                memmove(window, window + 1, 2 * sizeof(const char *));
+                window_size = 2;
+            }
+        }
+        window[window_size++] = ip;
+        ip = analyze_bytecode(f, byteFile, ip, &empty_printer);
+        window[window_size] = ip;
+        for (int size = 2; size <= window_size; ++size) {
+            for (int k = 0; k < 2; ++k) {
+                count_sequence(tables[k], window + window_size - size, size, k == 1);
+            }
+        }
+    }
+
+    fprintf(f, "Operand-insensitive sequences:\n");
+    print_sequences(f, byteFile, tables[0], false);
+    fprintf(f, "\nOperand-sensitive sequences:\n");
+    print_sequences(f, byteFile, tables[1], true);
+    for (int k = 0; k < 2; ++k) {
+        frequency_table_free(tables[k]);
+    }
+    free(leaders);
 }
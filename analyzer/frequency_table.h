@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "../runtime/runtime.h"
+
+/**
+ * Hash table counting occurrences of byte strings (instructions or instruction sequences).
+ * Entries and their keys are bump-allocated from an arena of chunks and freed all at once,
+ * so counting one key costs a hash and an expected constant number of comparisons.
+ */
+
+#define FREQUENCY_TABLE_INITIAL_BUCKETS 1024
+#define FREQUENCY_ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct frequency_entry {
+    struct frequency_entry *next; // next entry of the bucket
+    u_int32_t hash;
+    int key_length;
+    // key bytes: the instructions themselves or, for operand-insensitive sequences, their opcodes
+    const char *key;
+    const char *ip; // first occurrence, used for printing
+    int size;       // number of instructions
+    int frequency;
+} frequency_entry;
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    char data[0];
+} arena_chunk;
+
+typedef struct {
+    frequency_entry **buckets;
+    u_int32_t buckets_number; // power of two
+    u_int32_t num;
+    arena_chunk *arena;
+} frequency_table;
+
+static void *checked_calloc(size_t number, size_t size) {
+    void *p = calloc(number, size);
+    if (p == NULL) {
+        failure("Severity ERROR: Can't allocate memory.\n");
+    }
+    return p;
+}
+
+static void *arena_alloc(frequency_table *table, size_t size) {
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (table->arena == NULL || table->arena->used + size > table->arena->size) {
+        size_t chunk_size = size > FREQUENCY_ARENA_CHUNK_SIZE ? size : FREQUENCY_ARENA_CHUNK_SIZE;
+        arena_chunk *chunk = malloc(sizeof(arena_chunk) + chunk_size);
+        if (chunk == NULL) {
+            failure("Severity ERROR: Can't allocate memory.\n");
+        }
+        chunk->next = table->arena;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        table->arena = chunk;
+    }
+    void *p = table->arena->data + table->arena->used;
+    table->arena->used += size;
+    return p;
+}
+
+frequency_table *frequency_table_init(void) {
+    frequency_table *table = checked_calloc(1, sizeof(frequency_table));
+    table->buckets_number = FREQUENCY_TABLE_INITIAL_BUCKETS;
+    table->buckets = checked_calloc(table->buckets_number, sizeof(frequency_entry *));
+    return table;
+}
+
+void frequency_table_free(frequency_table *table) {
+    arena_chunk *chunk = table->arena;
+    while (chunk != NULL) {
+        arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(table->buckets);
+    free(table);
+}
+
+// FNV-1a
+static inline u_int32_t frequency_hash(const char *key, int key_length) {
+    u_int32_t hash = 2166136261u;
+    for (int i = 0; i < key_length; ++i) {
+        hash = (hash ^ (u_int8_t) key[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void frequency_table_grow(frequency_table *table) {
+    u_int32_t buckets_number = table->buckets_number << 1;
+    frequency_entry **buckets = checked_calloc(buckets_number, sizeof(frequency_entry *));
+    for (u_int32_t i = 0; i < table->buckets_number; ++i) {
+        frequency_entry *entry = table->buckets[i];
+        while (entry != NULL) {
+            frequency_entry *next = entry->next;
+            u_int32_t bucket = entry->hash & (buckets_number - 1);
+            entry->next = buckets[bucket];
+            buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->buckets_number = buckets_number;
+}
+
+// counts one more occurrence of key, ip and size describe the occurrence for printing
+frequency_entry *frequency_table_count(frequency_table *table, const char *key, int key_length, const char *ip,
+                                       int size) {
+    u_int32_t hash = frequency_hash(key, key_length);
+    frequency_entry **bucket = &table->buckets[hash & (table->buckets_number - 1)];
+    for (frequency_entry *entry = *bucket; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->key_length == key_length && !memcmp(entry->key, key, key_length)) {
+            entry->frequency++;
+            return entry;
+        }
+    }
+
+    frequency_entry *entry = arena_alloc(table, sizeof(frequency_entry));
+    char *entry_key = arena_alloc(table, key_length);
+    memcpy(entry_key, key, key_length);
+    entry->hash = hash;
+    entry->key_length = key_length;
+    entry->key = entry_key;
+    entry->ip = ip;
+    entry->size = size;
+    entry->frequency = 1;
+    entry->next = *bucket;
+    *bucket = entry;
+    if (++table->num > table->buckets_number / 4 * 3) {
+        frequency_table_grow(table);
+    }
+    return entry;
+}
+
+// copies all entries into a newly allocated array of table->num entries
+frequency_entry *frequency_table_entries(const frequency_table *table) {
+    frequency_entry *entries = malloc((table->num + 1) * sizeof(frequency_entry));
+    if (entries == NULL) {
+        failure("Severity ERROR: Can't allocate memory.\n");
+    }
+    int i = 0;
+    for (u_int32_t bucket = 0; bucket < table->buckets_number; ++bucket) {
+        for (frequency_entry *entry = table->buckets[bucket]; entry != NULL; entry = entry->next) {
+            entries[i++] = *entry;
+        }
+    }
+    return entries;
+}
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include "runtime/runtime.h"
 
 
@@ -10,12 +11,13 @@ typedef struct {
     char *string_ptr;
     u_int32_t *public_ptr;
     char *code_ptr;
-    u_int32_t *global_ptr;
+    auint *global_ptr;
+    u_int32_t bytecode_size;
+    // the file is read starting here
     u_int32_t string_table_size;
     u_int32_t global_area_size;
     u_int32_t public_symbols_number;
     char buffer[0];
-    u_int32_t bytecode_size;
 } byte_file;
 
 byte_file *read_file(char *file_name) {
@@ -30,7 +32,7 @@ byte_file *read_file(char *file_name) {
         failure("%s\n", strerror(errno));
     }
     long file_size = ftell(f);
-    bf = (byte_file *) malloc(sizeof(int) * 4 + file_size);
+    bf = (byte_file *) malloc(offsetof(byte_file, string_table_size) + file_size);
 
     if (bf == 0) {
         failure("Severity ERROR: unable to allocate memory for byte_file.\n");
@@ -38,7 +40,7 @@ byte_file *read_file(char *file_name) {
 
     rewind(f);
 
-    if (file_size != fread(&bf->string_table_size, 1, file_size, f)) {
+    if ((size_t) file_size != fread(&bf->string_table_size, 1, file_size, f)) {
         failure("%s\n", strerror(errno));
     }
 
@@ -47,7 +49,7 @@ byte_file *read_file(char *file_name) {
     bf->string_ptr = &bf->buffer[bf->public_symbols_number * 2 * sizeof(int)];
     bf->public_ptr = (u_int32_t *) bf->buffer;
     bf->code_ptr = (char *) &bf->string_ptr[bf->string_table_size];
-    bf->global_ptr = (u_int32_t *) malloc(bf->global_area_size * sizeof(int));
+    bf->global_ptr = (auint *) calloc(bf->global_area_size, sizeof(auint));
     bf->bytecode_size = (char *) &bf->string_table_size + file_size - bf->code_ptr;
     return bf;
 }
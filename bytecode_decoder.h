@@ -1,11 +1,17 @@
 # pragma once
 
 #include <stdbool.h>
+#include "runtime/runtime.h"
 
 #define LOW_BITS_COUNT 4
 #define LOW_BITS_MASK ((1 << LOW_BITS_COUNT) - 1)
 #define HIGH_BITS_MASK ~LOW_BITS_MASK
 
+// redefined from runtime.c for performance using the preprocessor, values are words of aint (see runtime.h)
+# define UNBOXED(x)  (((aint) (x)) &  0x0001)
+# define UNBOX(x)    (((aint) (x)) >> 1)
+# define BOX(x)      ((aint) (((auint) (x)) << 1) | 0x0001)
+
 typedef enum {
     BINOP = 0x00,
     CONST = 0x10,
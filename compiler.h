@@ -0,0 +1,445 @@
+#pragma once
+
+#include "predecoder.h"
+#include "verifier.h"
+
+/**
+ * Ahead-of-time compiler of bytecode to C.
+ * Every function of a verified pre-decoded program becomes a C function working with the virtual stack
+ * exactly as the interpreter does: the same frame layout, the same B* and L* runtime calls and the same
+ * order of operands, so the generated program is linked with runtime.c and gc_runtime.s and the GC walks
+ * its frames as in the VM. In a generated function
+ *   sp  caches __gc_stack_top and is written back before every call that may allocate or reads the stack,
+ *   fp  is the frame pointer of the function, lama_fp the frame pointer of the running one (stack_fp),
+ *   jumps are gotos to labels of their targets, calls are C calls with the zero return address,
+ *   a tail call replaces the frame and ends in a C call in tail position, which gcc -O2 turns into a jump,
+ *   a self tail call jumps to the beginning of the function.
+ * Globals are placed in the custom_data section, which the GC scans as the static roots of Lama programs.
+ * Stack slots are words of uintptr_t as in the runtime, so the output builds for both word sizes:
+ *   gcc -m32 -O2 -fno-omit-frame-pointer -pthread prog.c runtime/runtime.c runtime/gc_runtime.s -o prog
+ *   gcc -m64 -O2 -fno-omit-frame-pointer -pthread prog.c runtime/runtime.c runtime/gc_runtime64.s -o prog
+ */
+
+static const char *const compiled_prelude =
+        "#include <stdlib.h>\n"
+        "#include <string.h>\n"
+        "#include <stdint.h>\n"
+        "\n"
+        "#define UNBOXED(x) (((intptr_t) (x)) & 0x0001)\n"
+        "#define UNBOX(x) (((intptr_t) (x)) >> 1)\n"
+        "#define BOX(x) ((intptr_t) (((uintptr_t) (x)) << 1) | 0x0001)\n"
+        "#define PUSH(VALUE) (*--sp = (uintptr_t) (VALUE))\n"
+        "#define POP() (*sp++)\n"
+        "#define SYNC() (__gc_stack_top = sp)\n"
+        "#define RELOAD() (sp = __gc_stack_top)\n"
+        "#define CLOSURE_SLOT(INDEX) (((uintptr_t *) fp[fp[1] + 2])[(INDEX) + 1])\n"
+        "#define READ_BARRIER(VALUE) (gc_collecting ? (uintptr_t) gc_read_barrier((void *) (VALUE)) : (VALUE))\n"
+        "#define LAMA_VSTACK_SIZE (1024 * 1024)\n"
+        "\n"
+        "extern void failure(char *s, ...);\n"
+        "extern intptr_t Lread();\n"
+        "extern intptr_t Lwrite(intptr_t);\n"
+        "extern intptr_t Llength(void *);\n"
+        "extern void *Lstring(void *p);\n"
+        "extern void *Bstring(void *);\n"
+        "extern void *Belem(void *p, intptr_t i);\n"
+        "extern void *Bsta(void *v, intptr_t i, void *x);\n"
+        "extern void *Barray_my(intptr_t bn, intptr_t *data_);\n"
+        "extern void *Bsexp_my(intptr_t bn, intptr_t tag, intptr_t *data_);\n"
+        "extern intptr_t Btag(void *d, intptr_t t, intptr_t n);\n"
+        "extern intptr_t Barray_patt(void *d, intptr_t n);\n"
+        "extern void *Bclosure_my(intptr_t bn, void *entry, intptr_t *values);\n"
+        "extern intptr_t Bstring_patt(void *x, void *y);\n"
+        "extern intptr_t Bstring_tag_patt(void *x);\n"
+        "extern intptr_t Barray_tag_patt(void *x);\n"
+        "extern intptr_t Bsexp_tag_patt(void *x);\n"
+        "extern intptr_t Bunboxed_patt(void *x);\n"
+        "extern intptr_t Bboxed_patt(void *x);\n"
+        "extern intptr_t Bclosure_tag_patt(void *x);\n"
+        "extern uintptr_t *__gc_stack_top, *__gc_stack_bottom;\n"
+        "extern void __gc_init(void);\n"
+        "extern void gc_write_barrier(void **slot, void *v);\n"
+        "extern int gc_collecting;\n"
+        "extern void *gc_read_barrier(void *v);\n"
+        "extern void gc_set_root_scanner(void (*scanner)(void (*visit)(size_t **root)));\n"
+        "\n"
+        "// entry of a closure: the code of the function and the number of arguments it takes\n"
+        "typedef struct {\n"
+        "    void (*code)(void);\n"
+        "    uintptr_t n_args;\n"
+        "} lama_function;\n"
+        "\n"
+        "static uintptr_t *stack_start;\n"
+        "static uintptr_t *lama_fp;\n"
+        "\n"
+        "// precise roots: the values of the virtual stack, the saved fp, the argument count and the return address\n"
+        "// of each frame are skipped\n"
+        "static void lama_scan_stack(void (*visit)(size_t **root)) {\n"
+        "    uintptr_t *slot = __gc_stack_top;\n"
+        "    for (uintptr_t *fp = lama_fp; fp != __gc_stack_bottom; fp = (uintptr_t *) fp[0]) {\n"
+        "        for (; slot < fp; ++slot) {\n"
+        "            visit((size_t **) slot);\n"
+        "        }\n"
+        "        slot = fp + 3;\n"
+        "    }\n"
+        "    for (; slot < __gc_stack_bottom; ++slot) {\n"
+        "        visit((size_t **) slot);\n"
+        "    }\n"
+        "}\n"
+        "\n"
+        "static void lama_stack_overflow(void) {\n"
+        "    failure(\"Severity ERROR: Virtual stack limit exceeded.\\n\");\n"
+        "}\n"
+        "\n"
+        "// replaces the frame fp with the frame of the call whose n_words operands are on top of the stack\n"
+        "static inline void lama_tail_call(uintptr_t *sp, uintptr_t *fp, uintptr_t n_words, uintptr_t n_args) {\n"
+        "    uintptr_t *base = fp + 3 + fp[1];\n"
+        "    uintptr_t return_address = fp[2];\n"
+        "    lama_fp = (uintptr_t *) fp[0];\n"
+        "    memmove(base - n_words, sp, n_words * sizeof(uintptr_t));\n"
+        "    sp = base - n_words;\n"
+        "    PUSH(return_address);\n"
+        "    PUSH(n_args);\n"
+        "    SYNC();\n"
+        "}\n"
+        "\n";
+
+// code of the closure called with n_args arguments, checked against the table of functions,
+// unused in programs without closure calls
+static const char *const compiled_closure_code =
+        "__attribute__((unused)) static void (*lama_closure_code(uintptr_t closure, uintptr_t n_args))(void) {\n"
+        "    const lama_function *f = (const lama_function *) Belem((void *) closure, BOX(0));\n"
+        "    if (f < lama_functions || f >= lama_functions + sizeof(lama_functions) / sizeof(lama_function)\n"
+        "        || ((const char *) f - (const char *) lama_functions) % sizeof(lama_function) != 0) {\n"
+        "        failure(\"Severity ERROR: Closure entry is not a function.\\n\");\n"
+        "    }\n"
+        "    if (f->n_args != n_args) {\n"
+        "        failure(\"Severity ERROR: Closure of %d arguments called with %d.\\n\", (int) f->n_args, (int) n_args);\n"
+        "    }\n"
+        "    return f->code;\n"
+        "}\n"
+        "\n";
+
+static void compile_string_table(FILE *out, const byte_file *bf) {
+    fprintf(out, "__attribute__((unused)) static char lama_strings[%u] =\n        \"", bf->string_table_size + 1);
+    for (u_int32_t i = 0; i < bf->string_table_size; ++i) {
+        unsigned char c = bf->string_ptr[i];
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c >= ' ' && c < 127 && c != '?') {
+            fputc(c, out);
+        } else {
+            // octal escapes are never continued by the next character
+            fprintf(out, "\\%c%c%c", '0' + (c >> 6), '0' + ((c >> 3) & 7), '0' + (c & 7));
+        }
+        if (c == '\0' && i + 1 < bf->string_table_size) {
+            fprintf(out, "\"\n        \"");
+        }
+    }
+    fprintf(out, "\";\n\n");
+}
+
+static const char *const compiled_binops[] = {
+        [OP_BINOP_MULTIPLY] = "*", [OP_BINOP_DIVIDE] = "/", [OP_BINOP_REMAINDER] = "%",
+        [OP_BINOP_LESS] = "<", [OP_BINOP_LESS_EQUAL] = "<=", [OP_BINOP_GREATER] = ">",
+        [OP_BINOP_GREATER_EQUAL] = ">=", [OP_BINOP_EQUAL] = "==", [OP_BINOP_NOT_EQUAL] = "!=",
+        [OP_BINOP_AND] = "&&", [OP_BINOP_OR] = "||",
+};
+
+static const char *const compiled_patterns[] = {
+        [OP_PATT_TAG_STR] = "Bstring_tag_patt", [OP_PATT_TAG_ARR] = "Barray_tag_patt",
+        [OP_PATT_TAG_SEXP] = "Bsexp_tag_patt", [OP_PATT_BOXED] = "Bboxed_patt",
+        [OP_PATT_UNBOXED] = "Bunboxed_patt", [OP_PATT_TAG_CLOSURE] = "Bclosure_tag_patt",
+};
+
+// C expression of the variable with the given location
+static void compile_location(FILE *out, u_int32_t opcode, u_int32_t index) {
+    switch ((opcode - OP_LD_GLOBAL) % 4) {
+        case GLOBAL:
+            fprintf(out, "lama_globals[%u]", index);
+            break;
+        case LOCAL:
+            fprintf(out, "fp[-%u]", index + 1);
+            break;
+        case ARGUMENT:
+            fprintf(out, "fp[%u]", index + 3);
+            break;
+        default:
+            fprintf(out, "CLOSURE_SLOT(%u)", index);
+            break;
+    }
+}
+
+// a location as a value: captured values go through the read barrier of the incremental GC
+static void compile_load(FILE *out, u_int32_t opcode, u_int32_t index) {
+    if ((opcode - OP_LD_GLOBAL) % 4 == CLOJURE) {
+        fprintf(out, "READ_BARRIER(CLOSURE_SLOT(%u))", index);
+    } else {
+        compile_location(out, opcode, index);
+    }
+}
+
+static void compile_instruction(FILE *out, const decoded_program *program, u_int32_t function, u_int32_t index) {
+    const instruction *insn = &program->code[index];
+    u_int32_t callee;
+    switch (insn->opcode) {
+        case OP_BINOP_PLUS:
+            fprintf(out, "    sp[1] = sp[1] + sp[0] - 1; ++sp;\n");
+            break;
+        case OP_BINOP_MINUS:
+            fprintf(out, "    sp[1] = sp[1] - sp[0] + 1; ++sp;\n");
+            break;
+        case OP_BINOP_MULTIPLY:
+        case OP_BINOP_DIVIDE:
+        case OP_BINOP_REMAINDER:
+        case OP_BINOP_LESS:
+        case OP_BINOP_LESS_EQUAL:
+        case OP_BINOP_GREATER:
+        case OP_BINOP_GREATER_EQUAL:
+        case OP_BINOP_EQUAL:
+        case OP_BINOP_NOT_EQUAL:
+        case OP_BINOP_AND:
+        case OP_BINOP_OR:
+            fprintf(out, "    sp[1] = BOX(UNBOX(sp[1]) %s UNBOX(sp[0])); ++sp;\n", compiled_binops[insn->opcode]);
+            break;
+        case OP_LD_GLOBAL:
+        case OP_LD_LOCAL:
+        case OP_LD_ARGUMENT:
+        case OP_LD_CLOJURE:
+            fprintf(out, "    PUSH(");
+            compile_load(out, insn->opcode, insn->arg1);
+            fprintf(out, ");\n");
+            break;
+        case OP_LDA_GLOBAL:
+        case OP_LDA_LOCAL:
+        case OP_LDA_ARGUMENT:
+        case OP_LDA_CLOJURE:
+            fprintf(out, "    PUSH(&");
+            compile_location(out, insn->opcode, insn->arg1);
+            fprintf(out, ");\n");
+            break;
+        case OP_ST_GLOBAL:
+        case OP_ST_LOCAL:
+        case OP_ST_ARGUMENT:
+            fprintf(out, "    ");
+            compile_location(out, insn->opcode, insn->arg1);
+            fprintf(out, " = sp[0];\n");
+            break;
+        case OP_ST_CLOJURE:
+            fprintf(out, "    CLOSURE_SLOT(%u) = sp[0]; gc_write_barrier((void **) &CLOSURE_SLOT(%u), (void *) sp[0]);\n",
+                    (u_int32_t) insn->arg1, (u_int32_t) insn->arg1);
+            break;
+        case OP_PATT_STR:
+            fprintf(out, "    sp[1] = Bstring_patt((void *) sp[0], (void *) sp[1]); ++sp;\n");
+            break;
+        case OP_PATT_TAG_STR:
+        case OP_PATT_TAG_ARR:
+        case OP_PATT_TAG_SEXP:
+        case OP_PATT_BOXED:
+        case OP_PATT_UNBOXED:
+        case OP_PATT_TAG_CLOSURE:
+            fprintf(out, "    sp[0] = %s((void *) sp[0]);\n", compiled_patterns[insn->opcode]);
+            break;
+        case OP_CONST:
+            fprintf(out, "    PUSH(BOX(%d));\n", (int) UNBOX(insn->arg1));
+            break;
+        case OP_STRING:
+            fprintf(out, "    SYNC(); { uintptr_t r = (uintptr_t) Bstring(lama_strings + %u); PUSH(r); }\n",
+                    (u_int32_t) ((const char *) insn->arg1 - program->byteFile->string_ptr));
+            break;
+        case OP_SEXP:
+            fprintf(out, "    SYNC(); { uintptr_t r = (uintptr_t) Bsexp_my(%d, 0x%x, (intptr_t *) sp); sp += %u; PUSH(r); }\n",
+                    (int) BOX(insn->arg2 + 1), (u_int32_t) insn->arg1, insn->arg2);
+            break;
+        case OP_STA:
+            fprintf(out, "    { uintptr_t v = POP(), i = POP(); void *x = UNBOXED(i) ? (void *) POP() : 0;\n"
+                         "      uintptr_t r = (uintptr_t) Bsta((void *) v, i, x); PUSH(r); }\n");
+            break;
+        case OP_JMP:
+            fprintf(out, "    goto L%u;\n", (u_int32_t) insn->arg1);
+            break;
+        case OP_CJMP_Z:
+            fprintf(out, "    if (UNBOX(POP()) == 0) goto L%u;\n", (u_int32_t) insn->arg1);
+            break;
+        case OP_CJMP_NZ:
+            fprintf(out, "    if (UNBOX(POP()) != 0) goto L%u;\n", (u_int32_t) insn->arg1);
+            break;
+        case OP_ELEM:
+            fprintf(out, "    sp[1] = (uintptr_t) Belem((void *) sp[1], sp[0]); ++sp;\n");
+            break;
+        case OP_BEGIN: {
+            const function_info *f = &program->functions[insn->arg1];
+            fprintf(out, "    if (sp - stack_start < %u) lama_stack_overflow();\n", f->frame_size);
+            fprintf(out, "    PUSH(lama_fp); fp = lama_fp = sp;\n");
+            for (u_int32_t i = 0; i < insn->arg2; ++i) {
+                fprintf(out, "    PUSH(BOX(0));\n");
+            }
+            break;
+        }
+        case OP_CALL:
+            callee = program->code[insn->arg1].arg1;
+            fprintf(out, "    PUSH(0); PUSH(%u); SYNC(); lama_f%u(); RELOAD();\n", insn->arg2, callee);
+            break;
+        case OP_CALLC:
+            fprintf(out, "    { void (*code)(void) = lama_closure_code(sp[%u], %u);\n"
+                         "      PUSH(0); PUSH(%u); SYNC(); code(); RELOAD(); }\n",
+                    (u_int32_t) insn->arg1, (u_int32_t) insn->arg1, (u_int32_t) insn->arg1 + 1);
+            break;
+        case OP_TAIL_CALL:
+            callee = program->code[insn->arg1].arg1;
+            fprintf(out, "    lama_tail_call(sp, fp, %u, %u);\n", insn->arg2, insn->arg2);
+            if (callee == function) {
+                fprintf(out, "    RELOAD(); goto entry;\n");
+            } else {
+                fprintf(out, "    lama_f%u(); return;\n", callee);
+            }
+            break;
+        case OP_TAIL_CALLC:
+            fprintf(out, "    { void (*code)(void) = lama_closure_code(sp[%u], %u);\n"
+                         "      lama_tail_call(sp, fp, %u, %u); code(); return; }\n",
+                    (u_int32_t) insn->arg1, (u_int32_t) insn->arg1, (u_int32_t) insn->arg1 + 1,
+                    (u_int32_t) insn->arg1 + 1);
+            break;
+        case OP_CALL_READ:
+            fprintf(out, "    { uintptr_t r = Lread(); PUSH(r); }\n");
+            break;
+        case OP_CALL_WRITE:
+            fprintf(out, "    sp[0] = Lwrite(sp[0]);\n");
+            break;
+        case OP_CALL_STRING:
+            fprintf(out, "    SYNC(); sp[0] = (uintptr_t) Lstring((void *) sp[0]);\n");
+            break;
+        case OP_CALL_LENGTH:
+            fprintf(out, "    sp[0] = Llength((void *) sp[0]);\n");
+            break;
+        case OP_CALL_ARRAY:
+            fprintf(out, "    SYNC(); { uintptr_t r = (uintptr_t) Barray_my(%d, (intptr_t *) sp); sp += %u; PUSH(r); }\n",
+                    (int) BOX(insn->arg1), (u_int32_t) insn->arg1);
+            break;
+        case OP_END:
+            fprintf(out, "    { uintptr_t r = sp[0]; sp = fp + 2 + fp[1]; lama_fp = (uintptr_t *) fp[0];"
+                         " sp[0] = r; SYNC(); return; }\n");
+            break;
+        case OP_DROP:
+            fprintf(out, "    ++sp;\n");
+            break;
+        case OP_DUP:
+            fprintf(out, "    { uintptr_t t = sp[0]; PUSH(t); }\n");
+            break;
+        case OP_SWAP:
+            fprintf(out, "    { uintptr_t t = sp[0]; sp[0] = sp[1]; sp[1] = t; }\n");
+            break;
+        case OP_TAG:
+            fprintf(out, "    sp[0] = Btag((void *) sp[0], 0x%x, %d);\n", (u_int32_t) insn->arg1, (int) BOX(insn->arg2));
+            break;
+        case OP_ARRAY:
+            fprintf(out, "    sp[0] = Barray_patt((void *) sp[0], %d);\n", (int) BOX(insn->arg1));
+            break;
+        case OP_CLOSURE: {
+            // captured values go to the stack, where the GC updates them while the closure is allocated
+            const u_int32_t *captures = program->captures + insn->arg2;
+            for (u_int32_t i = captures[0]; i-- > 0;) {
+                fprintf(out, "    PUSH(");
+                compile_load(out, OP_LD_GLOBAL + captures[2 * i + 1], captures[2 * i + 2]);
+                fprintf(out, ");\n");
+            }
+            fprintf(out, "    SYNC(); { uintptr_t r = (uintptr_t) Bclosure_my(%d, (void *) &lama_functions[%u],"
+                         " (intptr_t *) sp); sp += %u; PUSH(r); }\n",
+                    (int) BOX(captures[0]), (u_int32_t) program->code[insn->arg1].arg1, captures[0]);
+            break;
+        }
+        case OP_LINE:
+            break;
+        case OP_FAIL:
+            fprintf(out, "    failure(\"Severity RUNTIME: Failed executing FAIL %%d %%d.\\n\", %u, %u);\n",
+                    (u_int32_t) insn->arg1, insn->arg2);
+            break;
+        case OP_STI:
+            fprintf(out, "    failure(\"Severity RUNTIME: STI bytecode is deprecated.\\n\");\n");
+            break;
+        case OP_RET:
+            fprintf(out, "    failure(\"Severity RUNTIME: RET bytecode has UB.\\n\");\n");
+            break;
+        default:
+            fprintf(out, "    failure(\"Severity ERROR: Unknown bytecode type.\\n\");\n");
+            break;
+    }
+}
+
+static void compile_function(FILE *out, const decoded_program *program, u_int32_t function, const bool *targets) {
+    const function_info *f = &program->functions[function];
+    u_int32_t end = function + 1 < program->functions_number ? program->functions[function + 1].entry
+                                                             : program->length;
+    bool self_tail_call = false;
+    for (u_int32_t i = f->entry; i < end; ++i) {
+        const instruction *insn = &program->code[i];
+        self_tail_call |= insn->opcode == OP_TAIL_CALL && program->code[insn->arg1].arg1 == function;
+    }
+    fprintf(out, "static void lama_f%u(void) {\n", function);
+    fprintf(out, "    uintptr_t *sp = __gc_stack_top, *fp;\n");
+    if (self_tail_call) {
+        fprintf(out, "entry:\n");
+    }
+    for (u_int32_t i = f->entry; i < end; ++i) {
+        if (targets[i]) {
+            fprintf(out, "L%u:\n", i);
+        }
+        fprintf(out, "    // %s\n", opcode_names[program->code[i].opcode]);
+        compile_instruction(out, program, function, i);
+    }
+    fprintf(out, "}\n\n");
+}
+
+// prints the C program of a verified program, whose superinstructions are not selected
+void compile_program(FILE *out, const decoded_program *program) {
+    if (!program->verified) {
+        failure("Severity ERROR: Only verified bytecode is compiled, %s.\n", verification_error);
+    }
+    const byte_file *bf = program->byteFile;
+    bool *targets = calloc(program->length, sizeof(bool));
+    if (targets == NULL) {
+        failure("Severity ERROR: Can't allocate memory.\n");
+    }
+    for (u_int32_t i = 0; i < program->length; ++i) {
+        u_int32_t opcode = program->code[i].opcode;
+        if (opcode == OP_JMP || opcode == OP_CJMP_Z || opcode == OP_CJMP_NZ) {
+            targets[program->code[i].arg1] = true;
+        }
+    }
+
+    fprintf(out, "%s", compiled_prelude);
+    fprintf(out, "static uintptr_t lama_globals[%u] __attribute__((used, section(\"custom_data\")));\n\n",
+            bf->global_area_size > 0 ? bf->global_area_size : 1);
+    compile_string_table(out, bf);
+    for (u_int32_t function = 0; function < program->functions_number; ++function) {
+        fprintf(out, "static void lama_f%u(void);\n", function);
+    }
+    fprintf(out, "\nstatic const lama_function lama_functions[] = {\n");
+    for (u_int32_t function = 0; function < program->functions_number; ++function) {
+        fprintf(out, "        {lama_f%u, %u},\n", function, program->functions[function].n_args);
+    }
+    fprintf(out, "};\n\n%s", compiled_closure_code);
+    for (u_int32_t function = 0; function < program->functions_number; ++function) {
+        compile_function(out, program, function, targets);
+    }
+    free(targets);
+
+    // the frame of the main function as init_interpreter() sets it up
+    fprintf(out, "int main(void) {\n"
+                 "    stack_start = malloc(LAMA_VSTACK_SIZE * sizeof(uintptr_t));\n"
+                 "    if (stack_start == NULL) {\n"
+                 "        failure(\"Severity ERROR: Failed to allocate memory for virtual stack.\\n\");\n"
+                 "    }\n"
+                 "    __gc_init();\n"
+                 "    __gc_stack_bottom = __gc_stack_top = stack_start + LAMA_VSTACK_SIZE;\n"
+                 "    gc_set_root_scanner(lama_scan_stack);\n"
+                 "    uintptr_t *sp = lama_fp = __gc_stack_top;\n"
+                 "    PUSH(0);\n"
+                 "    PUSH(0);\n"
+                 "    PUSH(0);\n"
+                 "    PUSH(2);\n"
+                 "    SYNC();\n"
+                 "    lama_f%u();\n"
+                 "    return 0;\n"
+                 "}\n", (u_int32_t) program->code[0].arg1);
+}
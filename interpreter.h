@@ -2,109 +2,135 @@
 
 #include "bytecode_decoder.h"
 #include "byte_file.h"
+#include "predecoder.h"
+#include "superinstructions.h"
 #include <stdbool.h>
 
-extern int Lread();
+extern aint Lread();
 
-extern int Lwrite(int);
+extern aint Lwrite(aint);
 
-extern int Llength(void *);
+extern aint Llength(void *);
 
 extern void *Lstring(void *p);
 
 extern void *Bstring(void *);
 
-extern void *Belem(void *p, int i);
+extern void *Belem(void *p, aint i);
 
-extern void *Bsta(void *v, int i, void *x);
+extern void *Bsta(void *v, aint i, void *x);
 
-extern void *Barray_my(int bn, int *data_);
+extern void *Barray_my(aint bn, aint *data_);
 
-extern void *Bsexp_my(int bn, int tag, int *data_);
+extern void *Bsexp_my(aint bn, aint tag, aint *data_);
 
-extern int LtagHash(char *s);
+extern aint Btag(void *d, aint t, aint n);
 
-extern int Btag(void *d, int t, int n);
+extern aint Barray_patt(void *d, aint n);
 
-extern int Barray_patt(void *d, int n);
+extern void *Bclosure_my(aint bn, void *entry, aint *values);
 
-extern void *Bclosure_my(int bn, void *entry, int *values);
+extern void *Belem_link(void *p, aint i);
 
-extern void *Belem_link(void *p, int i);
+extern aint Bstring_patt(void *x, void *y);
 
-extern int Bstring_patt(void *x, void *y);
+extern aint Bstring_tag_patt(void *x);
 
-extern int Bstring_tag_patt(void *x);
+extern aint Barray_tag_patt(void *x);
 
-extern int Barray_tag_patt(void *x);
+extern aint Bsexp_tag_patt(void *x);
 
-extern int Bsexp_tag_patt(void *x);
+extern aint Bunboxed_patt(void *x);
 
-extern int Bunboxed_patt(void *x);
+extern aint Bboxed_patt(void *x);
 
-extern int Bboxed_patt(void *x);
+extern aint Bclosure_tag_patt(void *x);
 
-extern int Bclosure_tag_patt(void *x);
-
-// redefined from runtime.c for performance using the preprocessor
-# define UNBOXED(x)  (((int) (x)) &  0x0001)
-# define UNBOX(x)    (((int) (x)) >> 1)
-# define BOX(x)      ((((int) (x)) << 1) | 0x0001)
-
-extern u_int32_t *__gc_stack_top, *__gc_stack_bottom;
-void *__start_custom_data, *__stop_custom_data;
+extern auint *__gc_stack_top, *__gc_stack_bottom;
+// the VM has no custom_data section, so the static roots the GC scans are an empty range
+void *__start_custom_data;
+extern void *__stop_custom_data __attribute__ ((alias ("__start_custom_data")));
 
 extern void __gc_init(void);
 
 static size_t RUNTIME_VSTACK_SIZE = 1024 * 1024;
-static u_int32_t *stack_fp;
-static u_int32_t *stack_start;
+
+typedef enum {
+    DISPATCH_SWITCH,
+    DISPATCH_THREADED
+} dispatch_mode;
+
+// dispatch loop used when none is requested explicitly, chosen at build time with -DTHREADED_DISPATCH
+#ifdef THREADED_DISPATCH
+static const dispatch_mode DEFAULT_DISPATCH = DISPATCH_THREADED;
+#else
+static const dispatch_mode DEFAULT_DISPATCH = DISPATCH_SWITCH;
+#endif
+
+typedef struct {
+    dispatch_mode dispatch;
+    // keep the top of the operand stack in a local variable of the dispatch loop
+    bool stack_cache;
+    // check every stack operation even if the program is verified
+    bool checked;
+} interpreter_options;
+
+static auint *stack_fp;
+static auint *stack_start;
 
 typedef struct {
     byte_file *byteFile;
-    char *ip;
+    decoded_program *program;
 } interpreter_state;
 
 interpreter_state interpreterState;
 
-static inline u_int8_t get_next_byte() {
-    return *interpreterState.ip++;
-}
+// code of a compiled function (see jit.h), returns the return address of the frame
+typedef instruction *(*native_function)(void);
 
-static inline u_int32_t get_next_int() {
-    interpreterState.ip += sizeof(int);
-    return *(u_int32_t *) (interpreterState.ip - sizeof(int));
-}
+typedef void (*interpreter)(instruction *);
 
-static inline char *get_next_string() {
-    return interpreterState.byteFile->string_ptr + get_next_int();
-}
+// the interpreter variant of the run, also used for interpreted callees of compiled code
+static interpreter current_interpreter;
+
+// promotes a hot function to the next tier (see tiering.h)
+void tier_up(u_int32_t function);
 
-static inline void vstack_push(u_int32_t value) {
+// continues the current frame in compiled code from the given instruction (see jit.h)
+instruction *osr_enter(u_int32_t target);
+
+static inline void vstack_push(auint value) {
     if (stack_start == __gc_stack_top) {
         failure("Severity ERROR: Virtual stack limit exceeded.\n");
     }
     *(--__gc_stack_top) = value;
 }
 
-static inline u_int32_t vstack_pop() {
+static inline auint vstack_pop() {
     if (__gc_stack_top >= stack_fp) {
         failure("Severity ERROR: Illegal pop.\n");
     }
     return *(__gc_stack_top++);
 }
 
-static inline void copy_on_stack(u_int32_t value, int count) {
+static inline auint vstack_top() {
+    if (__gc_stack_top >= stack_fp) {
+        failure("Severity ERROR: Illegal pop.\n");
+    }
+    return *__gc_stack_top;
+}
+
+static inline void copy_on_stack(auint value, int count) {
     for (int i = 0; i < count; ++i) {
         vstack_push(value);
     }
 }
 
 static inline void reverse_on_stack(int count) {
-    u_int32_t *st = __gc_stack_top;
-    u_int32_t *arg = st + count - 1;
+    auint *st = __gc_stack_top;
+    auint *arg = st + count - 1;
     while (st < arg) {
-        u_int32_t tmp = *st;
+        auint tmp = *st;
         *st = *arg;
         *arg = tmp;
         st++;
@@ -112,8 +138,8 @@ static inline void reverse_on_stack(int count) {
     }
 }
 
-u_int32_t *get_by_loc(u_int8_t bytecode, u_int32_t value) {
-    switch (low_bits(bytecode)) {
+auint *get_by_loc(u_int8_t loc, u_int32_t value) {
+    switch (loc) {
         case GLOBAL:
             return interpreterState.byteFile->global_ptr + value;
         case LOCAL:
@@ -121,358 +147,381 @@ u_int32_t *get_by_loc(u_int8_t bytecode, u_int32_t value) {
         case ARGUMENT:
             return stack_fp + value + 3;
         case CLOJURE : {
-            u_int32_t n_args = *(stack_fp + 1);
-            u_int32_t *argument = stack_fp + n_args + 2;
-            u_int32_t *closure = (u_int32_t *) *argument;
-            return (u_int32_t *) Belem_link(closure, BOX(value + 1));
+            auint n_args = *(stack_fp + 1);
+            auint *argument = stack_fp + n_args + 2;
+            auint *closure = (auint *) *argument;
+            return (auint *) Belem_link(closure, BOX(value + 1));
         }
         default:
             failure("Severity ERROR: Invalid bytecode for loc.\n");
     }
 }
 
-void exec_binop(u_int8_t bytecode) {
-#define BINOP_CODE(OP) \
-        {              \
-        int b = UNBOX(vstack_pop()); \
-        int a = UNBOX(vstack_pop()); \
-        vstack_push(BOX(a OP b)); \
-        return; \
-        }
-    switch (low_bits(bytecode)) {
-        case PLUS: BINOP_CODE(+)
-        case MINUS: BINOP_CODE(-)
-        case MULTIPLY: BINOP_CODE(*)
-        case DIVIDE: BINOP_CODE(/)
-        case REMAINDER: BINOP_CODE(%)
-        case LESS: BINOP_CODE(<)
-        case LESS_EQUAL: BINOP_CODE(<=)
-        case GREATER: BINOP_CODE(>)
-        case GREATER_EQUAL: BINOP_CODE(>=)
-        case EQUAL: BINOP_CODE(==)
-        case NOT_EQUAL: BINOP_CODE(!=)
-        case AND: BINOP_CODE(&&)
-        case OR: BINOP_CODE(||)
-        default:
-            failure("Severity ERROR: Unknown binop bytecode.\n");
-    }
-#undef BINOP_CODE
-}
-
-void exec_ld(u_int8_t bytecode) {
-    u_int32_t index = get_next_int();
-    u_int32_t value = *get_by_loc(bytecode, index);
-    vstack_push(value);
+// stack slot of the closure called by the current frame: the slot stays in place for the whole frame,
+// while the closure itself may be moved by GC
+static inline auint *frame_closure() {
+    return stack_fp + *(stack_fp + 1) + 2;
 }
 
-void exec_lda(u_int8_t bytecode) {
-    u_int32_t index = get_next_int();
-    u_int32_t value = (u_int32_t) get_by_loc(bytecode, index);
-    vstack_push(value);
+// address of the captured value of the closure in the given stack slot
+static inline auint *captured_value(const auint *closure_ref, u_int32_t index) {
+    return (auint *) *closure_ref + index + 1;
 }
 
-void exec_st(u_int8_t bytecode) {
-    u_int32_t index = get_next_int();
-    u_int32_t value = vstack_pop();
-    *get_by_loc(bytecode, index) = value;
-    vstack_push(value);
-}
-
-void exec_patt(u_int8_t bytecode) {
-    u_int32_t *element = (u_int32_t *) vstack_pop();
-    u_int32_t result = -1;
-    switch (low_bits(bytecode)) {
-        case PATT_STR: {
-            result = Bstring_patt(element, (u_int32_t *) vstack_pop());
-            break;
-        }
-        case PATT_TAG_STR: {
-            result = Bstring_tag_patt(element);
-            break;
-        }
-        case PATT_TAG_ARR: {
-            result = Barray_tag_patt(element);
-            break;
-        }
-        case PATT_TAG_SEXP: {
-            result = Bsexp_tag_patt(element);
-            break;
-        }
-        case PATT_BOXED: {
-            result = Bboxed_patt(element);
-            break;
-        }
-        case PATT_UNBOXED: {
-            result = Bunboxed_patt(element);
-            break;
-        }
-        case PATT_TAG_CLOSURE: {
-            result = Bclosure_tag_patt(element);
-            break;
-        }
-        default: {
-            failure("Severity RUNTIME: Unknown pattern type.\n");
-        }
+// checks that a closure call enters a function expecting n_args arguments
+void check_closure_entry(const instruction *entry, u_int32_t n_args) {
+    const decoded_program *program = interpreterState.program;
+    size_t offset = (const char *) entry - (const char *) program->code;
+    if (offset >= program->length * sizeof(instruction) || offset % sizeof(instruction) != 0
+        || (entry->opcode != OP_BEGIN && entry->opcode != OP_BEGIN_NATIVE && entry->opcode != OP_BEGIN_COUNTED)) {
+        failure("Severity ERROR: Closure entry is not a function.\n");
+    }
+    if (program->functions[entry->arg1].n_args != n_args) {
+        failure("Severity ERROR: Closure of %d arguments called with %d.\n",
+                program->functions[entry->arg1].n_args, n_args);
     }
-    vstack_push(result);
 }
 
-void exec_const() {
-    u_int32_t const_v = BOX(get_next_int());
-    vstack_push(const_v);
-}
+// redefined from runtime.c for objects allocated in place
+#define STRING_TAG 0x00000001
+#define ARRAY_TAG 0x00000003
+#define SEXP_TAG 0x00000005
+#define CLOSURE_TAG 0x00000007
 
-void exec_string() {
-    char *string = get_next_string();
-    vstack_push((u_int32_t) Bstring(string));
+// allocates an object of the given kind with a bump of the GC allocation pointer (see runtime.h),
+// returns NULL when it doesn't fit and the runtime has to allocate it
+static inline auint *inline_alloc(auint tag, size_t bytes) {
+    size_t words = (bytes - 1) / sizeof(size_t) + 1;
+    size_t *p = *gc_inline_alloc.current;
+    if (words > gc_inline_alloc.max_words || (size_t) (*gc_inline_alloc.end - p) <= words) {
+        return NULL;
+    }
+    *gc_inline_alloc.current = p + words;
+    gc_allocated[tag >> 1] += bytes;
+    return (auint *) p;
 }
 
-void exec_sexp() {
-    char *sexp_name = get_next_string();
-    u_int32_t sexp_tag = LtagHash(sexp_name);
-    u_int32_t sexp_arity = get_next_int();
-    reverse_on_stack(sexp_arity);
-    u_int32_t bsexp = (u_int32_t) Bsexp_my(BOX(sexp_arity + 1), sexp_tag, __gc_stack_top);
+void exec_string(char *string) {
+    size_t n = strlen(string);
+    auint *r = inline_alloc(STRING_TAG, n + 1 + sizeof(aint));
+    if (r == NULL) {
+        vstack_push((auint) Bstring(string));
+        return;
+    }
+    r[0] = STRING_TAG | (n << 3);
+    memcpy(r + 1, string, n + 1);
+    vstack_push((auint) (r + 1));
+}
+
+// the elements are on the stack, the last one on top
+void exec_sexp(u_int32_t sexp_tag, u_int32_t sexp_arity) {
+    auint *r = inline_alloc(SEXP_TAG, sizeof(aint) * (sexp_arity + 2));
+    if (r == NULL) {
+        auint bsexp = (auint) Bsexp_my(BOX(sexp_arity + 1), sexp_tag, (aint *) __gc_stack_top);
+        __gc_stack_top += sexp_arity;
+        vstack_push(bsexp);
+        return;
+    }
+    r[0] = UNBOX(sexp_tag);
+    r[1] = SEXP_TAG | (sexp_arity << 3);
+    for (u_int32_t i = 0; i < sexp_arity; i++) {
+        r[i + 2] = __gc_stack_top[sexp_arity - 1 - i];
+    }
     __gc_stack_top += sexp_arity;
-    vstack_push(bsexp);
+    vstack_push((auint) (r + 2));
 }
 
 void exec_sta() {
-    u_int32_t value = vstack_pop();
-    u_int32_t index = vstack_pop();
-    u_int32_t bsta;
+    auint value = vstack_pop();
+    auint index = vstack_pop();
+    auint bsta;
     if (UNBOXED(index)) {
-        bsta = (u_int32_t) Bsta((void *) value, index, (void *) vstack_pop());
+        bsta = (auint) Bsta((void *) value, index, (void *) vstack_pop());
     } else {
-        bsta = (u_int32_t) Bsta((void *) value, index, 0);
+        bsta = (auint) Bsta((void *) value, index, 0);
     }
     vstack_push(bsta);
 }
 
-void jump(u_int32_t ip_offset) {
-    interpreterState.ip = interpreterState.byteFile->code_ptr + ip_offset;
-}
-
-void exec_jmp() {
-    u_int32_t ip_offset = get_next_int();
-    jump(ip_offset);
-}
-
-void exec_cjmp_z() {
-    u_int32_t ip_offset = get_next_int();
-    int cmp_value = UNBOX(vstack_pop());
-    if (cmp_value == 0) {
-        jump(ip_offset);
-    }
-}
-
-void exec_cjmp_nz() {
-    u_int32_t ip_offset = get_next_int();
-    int cmp_value = UNBOX(vstack_pop());
-    if (cmp_value != 0) {
-        jump(ip_offset);
-    }
-}
-
 void exec_call_read() {
-    int r = Lread();
+    aint r = Lread();
     vstack_push(r);
 }
 
 void exec_call_write() {
-    int w = Lwrite(vstack_pop());
+    aint w = Lwrite(vstack_pop());
     vstack_push(w);
 }
 
 void exec_call_string() {
-    u_int32_t s = (u_int32_t) Lstring((void *) vstack_pop());
+    auint s = (auint) Lstring((void *) vstack_pop());
     vstack_push(s);
 }
 
 void exec_call_length() {
-    u_int32_t l = (u_int32_t) Llength((void *) vstack_pop());
+    auint l = (auint) Llength((void *) vstack_pop());
     vstack_push(l);
 }
 
-void exec_call_array() {
-    u_int32_t len = get_next_int();
-    reverse_on_stack(len);
-    u_int32_t result = (u_int32_t) Barray_my(BOX(len), (int *) __gc_stack_top);
+void exec_call_array(u_int32_t len) {
+    auint *r = inline_alloc(ARRAY_TAG, sizeof(aint) * (len + 1));
+    if (r == NULL) {
+        auint result = (auint) Barray_my(BOX(len), (aint *) __gc_stack_top);
+        __gc_stack_top += len;
+        vstack_push(result);
+        return;
+    }
+    r[0] = ARRAY_TAG | (len << 3);
+    for (u_int32_t i = 0; i < len; i++) {
+        r[i + 1] = __gc_stack_top[len - 1 - i];
+    }
     __gc_stack_top += len;
-    vstack_push(result);
+    vstack_push((auint) (r + 1));
 }
 
-void exec_closure() {
-    u_int32_t ip = get_next_int();
-    u_int32_t bn = get_next_int();
-    u_int32_t values[bn];
-    for (int i = 0; i < bn; ++i) {
-        u_int8_t b = (u_int8_t) get_next_byte();
-        u_int32_t value = (u_int32_t) get_next_int();
-        values[i] = *get_by_loc(b, value);
+// captured values go to the stack, the first one on top, where the GC updates them while the closure is allocated
+void exec_closure(instruction *entry, const u_int32_t *captures, const auint *closure_ref) {
+    u_int32_t bn = captures[0];
+    for (u_int32_t i = bn; i-- > 0;) {
+        u_int8_t loc = captures[2 * i + 1];
+        u_int32_t index = captures[2 * i + 2];
+        vstack_push(loc == CLOJURE ? (auint) GC_READ_BARRIER((void *) *captured_value(closure_ref, index))
+                                   : *get_by_loc(loc, index));
+    }
+    auint *r = inline_alloc(CLOSURE_TAG, sizeof(aint) * (bn + 2));
+    if (r == NULL) {
+        auint blosure = (auint) Bclosure_my(BOX(bn), entry, (aint *) __gc_stack_top);
+        __gc_stack_top += bn;
+        vstack_push(blosure);
+        return;
     }
-    u_int32_t blosure = (u_int32_t) Bclosure_my(BOX(bn), interpreterState.byteFile->code_ptr + ip, values);
-    vstack_push(blosure);
+    r[0] = CLOSURE_TAG | ((bn + 1) << 3);
+    r[1] = (auint) entry;
+    for (u_int32_t i = 0; i < bn; i++) {
+        r[i + 2] = __gc_stack_top[i];
+    }
+    __gc_stack_top += bn;
+    vstack_push((auint) (r + 1));
 }
 
-void exec_elem() {
-    u_int32_t index = vstack_pop();
-    void *p = (void *) vstack_pop();
-    u_int32_t belem = (u_int32_t) Belem(p, index);
-    vstack_push(belem);
-}
 
-void exec_begin() {
-    u_int32_t n_args = get_next_int();
-    u_int32_t n_locals = get_next_int();
-    vstack_push((u_int32_t) stack_fp);
+void exec_begin(u_int32_t n_locals) {
+    vstack_push((auint) stack_fp);
     stack_fp = __gc_stack_top;
     copy_on_stack(BOX(0), n_locals);
 }
 
-
-void exec_end() {
-    u_int32_t return_value = vstack_pop();
+// returns the instruction to continue with, NULL when the main function ends
+instruction *exec_end() {
+    auint return_value = vstack_pop();
     __gc_stack_top = stack_fp;
-    u_int32_t value_on_stack = *(__gc_stack_top++);
-    stack_fp = (u_int32_t *) value_on_stack;
-    u_int32_t n_args = vstack_pop();
-    char *addr = (char *) vstack_pop();
+    auint value_on_stack = *(__gc_stack_top++);
+    stack_fp = (auint *) value_on_stack;
+    auint n_args = vstack_pop();
+    instruction *addr = (instruction *) vstack_pop();
     __gc_stack_top += n_args;
     vstack_push(return_value);
-    interpreterState.ip = addr;
+    return addr;
 }
 
-void exec_drop() {
-    vstack_pop();
-}
-
-void exec_dup() {
-    copy_on_stack(vstack_pop(), 2);
-}
-
-void exec_tag() {
-    char *tag_name = get_next_string();
-    u_int32_t n = get_next_int();
-    u_int32_t t = LtagHash(tag_name);
-    void *d = (void *) vstack_pop();
-    vstack_push(Btag(d, t, BOX(n)));
+void exec_swap() {
+    reverse_on_stack(2);
 }
 
-void exec_array() {
-    u_int32_t len = get_next_int();
-    u_int32_t array = Barray_patt((u_int32_t *) vstack_pop(), BOX(len));
-    vstack_push(array);
+// arguments stay in the order they were pushed, see the ARGUMENT locations in predecode()
+void exec_call(instruction *return_address, u_int32_t n_args) {
+    vstack_push((auint) return_address);
+    vstack_push(n_args);
 }
 
-void exec_fail() {
-    u_int32_t a = get_next_int();
-    u_int32_t b = get_next_int();
-    failure("Severity RUNTIME: Failed executing FAIL %d %d.\n", a, b);
-}
+// kind of a heap object, kept in the low bits of the header word before its contents (see runtime.c)
+#define OBJECT_KIND(p) (((const auint *) (p))[-1] & 0x7)
+#define CLOSURE_KIND 0x7
 
-void exec_line() {
-    get_next_int();
+// returns the entry instruction of the closure called with n_args arguments on the stack; a closure with
+// the entry cached at the call site skips the runtime lookup and the entry check
+static inline instruction *closure_entry(call_site *site, u_int32_t n_args) {
+    const auint *closure = (const auint *) __gc_stack_top[n_args];
+    if (!UNBOXED(closure) && OBJECT_KIND(closure) == CLOSURE_KIND && (instruction *) closure[0] == site->entry) {
+        return (instruction *) site->entry;
+    }
+    instruction *callee = (instruction *) Belem((void *) closure, BOX(0));
+    check_closure_entry(callee, n_args);
+    site->entry = callee;
+    return callee;
 }
 
-void exec_swap() {
-    reverse_on_stack(2);
+// returns the entry instruction of the called closure
+instruction *exec_callc(call_site *site, instruction *return_address, u_int32_t n_args) {
+    instruction *callee = closure_entry(site, n_args);
+    vstack_push((auint) return_address);
+    vstack_push(n_args + 1);
+    return callee;
 }
 
-void exec_call() {
-    u_int32_t call_offset = get_next_int();
-    u_int32_t n_args = get_next_int();
-    reverse_on_stack(n_args);
-    vstack_push((u_int32_t) interpreterState.ip);
+// whether one of the n_words values on top of the stack points into the current frame, like a reference pushed
+// by LDA of a local, in which case the frame can't be reused by a tail call
+static bool frame_referenced(u_int32_t n_words) {
+    const auint *frame_end = stack_fp + 3 + stack_fp[1];
+    for (u_int32_t i = 0; i < n_words; ++i) {
+        auint value = __gc_stack_top[i];
+        if (value >= (auint) __gc_stack_top && value < (auint) frame_end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// replaces the current frame with the frame of the call whose n_words operands (arguments and the closure
+// of CALLC) are on top of the stack: they are moved over the arguments of the current frame, and the callee
+// returns straight to the caller of the current frame
+void exec_tail_call(u_int32_t n_words, u_int32_t n_args) {
+    auint *caller_fp = (auint *) stack_fp[0];
+    auint return_address = stack_fp[2];
+    auint *base = stack_fp + 3 + stack_fp[1];
+    memmove(base - n_words, __gc_stack_top, n_words * sizeof(auint));
+    __gc_stack_top = base - n_words;
+    stack_fp = caller_fp;
+    vstack_push(return_address);
     vstack_push(n_args);
-    interpreterState.ip = interpreterState.byteFile->code_ptr + call_offset;
 }
 
-void exec_callc() {
-    u_int32_t n_args = get_next_int();
-    char *callee = (char *) Belem((u_int32_t *) __gc_stack_top[n_args], BOX(0));
-    reverse_on_stack(n_args);
-    vstack_push((u_int32_t) interpreterState.ip);
-    vstack_push(n_args + 1);
-    interpreterState.ip = callee;
+// precise roots of the VM: the globals, and the values of the virtual stack found by walking the frames from
+// stack_fp, the saved fp, the argument count and the return address of each frame are skipped
+static void scan_vm_roots(gc_root_visitor visit) {
+    const byte_file *bf = interpreterState.byteFile;
+    for (u_int32_t i = 0; i < bf->global_area_size; ++i) {
+        visit((size_t **) &bf->global_ptr[i]);
+    }
+    auint *slot = __gc_stack_top;
+    for (auint *fp = stack_fp; fp != __gc_stack_bottom; fp = (auint *) fp[0]) {
+        for (; slot < fp; ++slot) {
+            visit((size_t **) slot);
+        }
+        slot = fp + 3;
+    }
+    for (; slot < __gc_stack_bottom; ++slot) {
+        visit((size_t **) slot);
+    }
 }
 
-
-void init_interpreter(byte_file *bf) {
-    stack_start = malloc(RUNTIME_VSTACK_SIZE * sizeof(u_int32_t));
+void init_interpreter(decoded_program *program) {
+    stack_start = malloc(RUNTIME_VSTACK_SIZE * sizeof(auint));
     if (stack_start == NULL) {
         failure("Severity ERROR: Failed to allocate memory for virtual stack.\n");
     }
-    // init __gc_stack_bottom and __gc_stack_top for detection of lama GC and call extern __gc__init
-    __gc_stack_bottom = __gc_stack_top = stack_start + RUNTIME_VSTACK_SIZE;
+    // __gc_init sets __gc_stack_bottom to the native stack, the GC scans the virtual one instead
     __gc_init();
+    __gc_stack_bottom = __gc_stack_top = stack_start + RUNTIME_VSTACK_SIZE;
+    gc_set_root_scanner(scan_vm_roots);
 
+    // the frame of the main function without its saved fp: the arguments, the zero return address,
+    // at which the interpreter stops, and the number of arguments, a tail call in main moves over them
     stack_fp = __gc_stack_top;
     vstack_push(0); // argv
     vstack_push(0); // argc
+    vstack_push(0);
     vstack_push(2);
 
-    interpreterState.byteFile = bf;
-    interpreterState.ip = bf->code_ptr;
+    interpreterState.byteFile = program->byteFile;
+    interpreterState.program = program;
+}
+
+
+// simple iterative interpreters over pre-decoded instructions
+#define INTERPRETER_NAME interpret
+#define THREADED 0
+#define TOS_CACHE 0
+#define CHECKED 1
+#include "interpreter_loop.h"
+
+#define INTERPRETER_NAME interpret_unchecked
+#define THREADED 0
+#define TOS_CACHE 0
+#define CHECKED 0
+#include "interpreter_loop.h"
+
+// the same interpreters keeping the top of the operand stack in a local variable
+#define INTERPRETER_NAME interpret_cached
+#define THREADED 0
+#define TOS_CACHE 1
+#define CHECKED 1
+#include "interpreter_loop.h"
+
+#define INTERPRETER_NAME interpret_cached_unchecked
+#define THREADED 0
+#define TOS_CACHE 1
+#define CHECKED 0
+#include "interpreter_loop.h"
+
+#ifdef __GNUC__
+static const void *const *threaded_handlers;
+
+// direct-threaded interpreters: each handler ends with its own indirect jump (GCC labels-as-values),
+// so the branch predictor sees one jump per handler instead of a single shared switch
+#define INTERPRETER_NAME interpret_threaded
+#define THREADED 1
+#define TOS_CACHE 0
+#define CHECKED 1
+#include "interpreter_loop.h"
+
+#define INTERPRETER_NAME interpret_threaded_unchecked
+#define THREADED 1
+#define TOS_CACHE 0
+#define CHECKED 0
+#include "interpreter_loop.h"
+
+#define INTERPRETER_NAME interpret_threaded_cached
+#define THREADED 1
+#define TOS_CACHE 1
+#define CHECKED 1
+#include "interpreter_loop.h"
+
+#define INTERPRETER_NAME interpret_threaded_cached_unchecked
+#define THREADED 1
+#define TOS_CACHE 1
+#define CHECKED 0
+#include "interpreter_loop.h"
+
+// stores the labels of the given threaded interpreter in every instruction
+void bind_threaded_handlers(decoded_program *program, void (*threaded_interpreter)(instruction *)) {
+    threaded_interpreter(NULL);
+    for (u_int32_t i = 0; i < program->length; ++i) {
+        program->code[i].handler = threaded_handlers[program->code[i].opcode];
+    }
 }
-
-
-// simple iterative bytecode interpreter
-void interpret() {
-    do {
-        u_int8_t bytecode = get_next_byte();
-        bytecode_type bc_type = get_bytecode_type(bytecode);
-#define EXEC_WITH_LOWER_BITS(BC_NAME, EXEC_SUFFIX) \
-        case BC_NAME:              \
-            exec_##EXEC_SUFFIX(bytecode);  \
+#endif
+
+// interpreter variants indexed by [stack_cache][checked]
+static const interpreter switch_interpreters[2][2] = {
+        {interpret_unchecked,        interpret},
+        {interpret_cached_unchecked, interpret_cached},
+};
+#ifdef __GNUC__
+static const interpreter threaded_interpreters[2][2] = {
+        {interpret_threaded_unchecked,        interpret_threaded},
+        {interpret_threaded_cached_unchecked, interpret_threaded_cached},
+};
+#endif
+
+void run_interpreter(interpreter_options options) {
+    instruction *entry = interpreterState.program->code;
+    // per-operation checks can only be dropped for programs accepted by the verifier
+    bool checked = options.checked || !interpreterState.program->verified;
+    switch (options.dispatch) {
+        case DISPATCH_SWITCH:
+            current_interpreter = switch_interpreters[options.stack_cache][checked];
+            current_interpreter(entry);
             break;
-#define EXEC(BC_NAME, EXEC_SUFFIX) \
-        case BC_NAME:              \
-            exec_##EXEC_SUFFIX();  \
+        case DISPATCH_THREADED: {
+#ifdef __GNUC__
+            current_interpreter = threaded_interpreters[options.stack_cache][checked];
+            bind_threaded_handlers(interpreterState.program, current_interpreter);
+            current_interpreter(entry);
+#else
+            failure("Severity ERROR: Threaded dispatch requires GCC labels-as-values.\n");
+#endif
             break;
-        switch (bc_type) {
-            /** interpret bytecodes with meaningful lower bits */
-            EXEC_WITH_LOWER_BITS(BINOP, binop)
-            EXEC_WITH_LOWER_BITS(LD, ld)
-            EXEC_WITH_LOWER_BITS(LDA, lda)
-            EXEC_WITH_LOWER_BITS(ST, st)
-            EXEC_WITH_LOWER_BITS(PATT, patt)
-            /** interpret other bytecodes  */
-            EXEC(CONST, const)
-            EXEC(XSTRING, string)
-            EXEC(SEXP, sexp)
-            EXEC(STA, sta)
-            EXEC(JMP, jmp)
-            EXEC(CJMP_Z, cjmp_z)
-            EXEC(CJMP_NZ, cjmp_nz)
-            EXEC(ELEM, elem)
-            EXEC(BEGIN, begin)
-            EXEC(CALL, call)
-            EXEC(CALLC, callc)
-            EXEC(CALL_READ, call_read)
-            EXEC(CALL_WRITE, call_write)
-            EXEC(CALL_STRING, call_string)
-            EXEC(CALL_LENGTH, call_length)
-            EXEC(CALL_ARRAY, call_array)
-            EXEC(END, end)
-            EXEC(DROP, drop)
-            EXEC(DUP, dup)
-            EXEC(TAG, tag)
-            EXEC(ARRAY, array)
-            EXEC(FAIL, fail)
-            EXEC(LINE, line)
-            EXEC(CLOSURE, closure)
-            EXEC(SWAP, swap)
-            case STI:
-                failure("Severity RUNTIME: STI bytecode is deprecated.\n");
-                break;
-            case RET:
-                failure("Severity RUNTIME: RET bytecode has UB.\n");
-                break;
-            default:
-                failure("Severity ERROR: Unknown bytecode type.\n");
         }
-    } while (interpreterState.ip != 0);
-#undef EXEC_WITH_LOWER_BITS
-#undef EXEC
-}
\ No newline at end of file
+    }
+}
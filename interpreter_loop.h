@@ -0,0 +1,476 @@
+/**
+ * Dispatch loop over pre-decoded instructions.
+ * Included by interpreter.h once per interpreter variant with the following parameters:
+ *   INTERPRETER_NAME  name of the generated function
+ *   THREADED          1 for direct threading over instruction.handler, 0 for a switch over instruction.opcode
+ *   TOS_CACHE         1 to keep the top of the operand stack in a local variable, 0 to keep it in memory
+ *   CHECKED           1 to check bounds on every stack operation, 0 for verified programs (see verifier.h),
+ *                     which only check at BEGIN that the virtual stack has room for the whole frame
+ * The generated function runs until a frame with the zero return address ends: the main function or,
+ * for interpreters nested in compiled code (see jit.h), the frame it was called for.
+ * The threaded variants called with NULL only export their handler labels through threaded_handlers.
+ *
+ * With TOS_CACHE the logical operand stack is tos followed by the memory stack from __gc_stack_top.
+ * The cached value is spilled to memory (SPILL) around everything that works with the memory stack:
+ * runtime calls that can trigger GC and scan the stack, calls, returns and frame setup.
+ * BEGIN leaves a BOX(0) placeholder in tos, so locals of a frame always stay in memory.
+ *
+ * closure_ref caches the stack slot of the closure of the current frame (see frame_closure()), it is set
+ * by BEGIN and whenever control comes back to a frame. The top-level interpreter starts before the BEGIN
+ * of the main function, with no frame yet.
+ */
+
+void INTERPRETER_NAME(instruction *ip) {
+    instruction *const code = interpreterState.program->code;
+    auint *const globals = interpreterState.byteFile->global_ptr;
+    const u_int32_t *const captures = interpreterState.program->captures;
+    function_info *const functions = interpreterState.program->functions;
+    call_site *const call_sites = interpreterState.program->call_sites;
+    auint *closure_ref = stack_fp == __gc_stack_bottom ? NULL : frame_closure();
+
+#if THREADED
+    static const void *const handlers[OP_COUNT] = {
+#define HANDLER_LABEL(NAME) [OP_##NAME] = &&op_##NAME,
+            FOR_EACH_OPCODE(HANDLER_LABEL)
+#undef HANDLER_LABEL
+    };
+    if (ip == NULL) {
+        threaded_handlers = handlers;
+        return;
+    }
+#define HANDLE(NAME) op_##NAME:
+#define DISPATCH() goto *ip->handler
+#else
+#define HANDLE(NAME) case OP_##NAME:
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT() do { ++ip; DISPATCH(); } while (0)
+// continues after a superinstruction of LENGTH fused instructions
+#define SKIP(LENGTH) do { ip += (LENGTH); DISPATCH(); } while (0)
+#define JUMP(TARGET) do { ip = code + (TARGET); DISPATCH(); } while (0)
+
+#if CHECKED
+#define STACK_PUSH(VALUE) vstack_push(VALUE)
+#define STACK_POP() vstack_pop()
+#define STACK_TOP() vstack_top()
+#define STACK_REPLACE_TOP(VALUE) (vstack_top(), *__gc_stack_top = (VALUE))
+#define CLOSURE_SLOT(INDEX) get_by_loc(CLOJURE, INDEX)
+#else
+// the value is computed first, it may read the stack top, as in PUSH(TOP())
+#define STACK_PUSH(VALUE) do { auint stack_pushed = (VALUE); *--__gc_stack_top = stack_pushed; } while (0)
+#define STACK_POP() (*__gc_stack_top++)
+#define STACK_TOP() (*__gc_stack_top)
+#define STACK_REPLACE_TOP(VALUE) (*__gc_stack_top = (VALUE))
+#define CLOSURE_SLOT(INDEX) captured_value(closure_ref, INDEX)
+#endif
+
+#if TOS_CACHE
+    auint tos = STACK_POP();
+    auint popped;
+#define PUSH(VALUE) do { auint pushed = (VALUE); STACK_PUSH(tos); tos = pushed; } while (0)
+#define POP() (popped = tos, tos = STACK_POP(), popped)
+#define TOP() tos
+#define REPLACE_TOP(VALUE) (tos = (VALUE))
+#define SPILL() STACK_PUSH(tos)
+#define FILL() (tos = STACK_POP())
+#else
+#define PUSH(VALUE) STACK_PUSH(VALUE)
+#define POP() STACK_POP()
+#define TOP() STACK_TOP()
+#define REPLACE_TOP(VALUE) STACK_REPLACE_TOP(VALUE)
+#define SPILL()
+#define FILL()
+#endif
+// runs STATEMENT, which works with the memory stack
+#define IN_MEMORY(STATEMENT) do { SPILL(); STATEMENT; FILL(); } while (0)
+
+#if THREADED
+    DISPATCH();
+#else
+    dispatch:
+    switch (ip->opcode) {
+#endif
+
+#define HANDLE_BINOP(NAME, OP) \
+    HANDLE(BINOP_##NAME) {     \
+        aint b = UNBOX(POP());  \
+        aint a = UNBOX(TOP());  \
+        REPLACE_TOP(BOX(a OP b)); \
+        NEXT();                \
+    }
+    // integers are added and subtracted tagged: (2a + 1) + (2b + 1) - 1 = 2(a + b) + 1
+    HANDLE(BINOP_PLUS) {
+        auint b = POP();
+        REPLACE_TOP(TOP() + b - 1);
+        NEXT();
+    }
+    HANDLE(BINOP_MINUS) {
+        auint b = POP();
+        REPLACE_TOP(TOP() - b + 1);
+        NEXT();
+    }
+    HANDLE_BINOP(MULTIPLY, *)
+    HANDLE_BINOP(DIVIDE, /)
+    HANDLE_BINOP(REMAINDER, %)
+    HANDLE_BINOP(LESS, <)
+    HANDLE_BINOP(LESS_EQUAL, <=)
+    HANDLE_BINOP(GREATER, >)
+    HANDLE_BINOP(GREATER_EQUAL, >=)
+    HANDLE_BINOP(EQUAL, ==)
+    HANDLE_BINOP(NOT_EQUAL, !=)
+    HANDLE_BINOP(AND, &&)
+    HANDLE_BINOP(OR, ||)
+#undef HANDLE_BINOP
+
+// BARRIER is set for the locations in heap objects, loads and stores of them go through the GC barriers
+#define HANDLE_LOC(LOC, ADDRESS, BARRIER)                        \
+    HANDLE(LD_##LOC) {                                           \
+        if (BARRIER) {                                           \
+            PUSH((auint) GC_READ_BARRIER((void *) *(ADDRESS)));  \
+        } else {                                                 \
+            PUSH(*(ADDRESS));                                    \
+        }                                                        \
+        NEXT();                                                  \
+    }                                                            \
+    HANDLE(LDA_##LOC) {                                          \
+        PUSH((auint) (ADDRESS));                                 \
+        NEXT();                                                  \
+    }                                                            \
+    HANDLE(ST_##LOC) {                                           \
+        auint *slot = (ADDRESS);                                 \
+        *slot = TOP();                                           \
+        if (BARRIER) {                                           \
+            gc_write_barrier((void **) slot, (void *) *slot);    \
+        }                                                        \
+        NEXT();                                                  \
+    }
+    HANDLE_LOC(GLOBAL, globals + ip->arg1, false)
+    HANDLE_LOC(LOCAL, stack_fp - ip->arg1 - 1, false)
+    HANDLE_LOC(ARGUMENT, stack_fp + ip->arg1 + 3, false)
+    HANDLE_LOC(CLOJURE, CLOSURE_SLOT(ip->arg1), true)
+#undef HANDLE_LOC
+
+#define HANDLE_PATT(NAME, FUNCTION) \
+    HANDLE(PATT_##NAME) {           \
+        REPLACE_TOP(FUNCTION((void *) TOP())); \
+        NEXT();                     \
+    }
+    HANDLE(PATT_STR) {
+        void *element = (void *) POP();
+        REPLACE_TOP(Bstring_patt(element, (void *) TOP()));
+        NEXT();
+    }
+    HANDLE_PATT(TAG_STR, Bstring_tag_patt)
+    HANDLE_PATT(TAG_ARR, Barray_tag_patt)
+    HANDLE_PATT(TAG_SEXP, Bsexp_tag_patt)
+    HANDLE_PATT(BOXED, Bboxed_patt)
+    HANDLE_PATT(UNBOXED, Bunboxed_patt)
+    HANDLE_PATT(TAG_CLOSURE, Bclosure_tag_patt)
+#undef HANDLE_PATT
+
+#define HANDLE_SIMPLE(NAME, EXEC_SUFFIX) \
+    HANDLE(NAME) {                       \
+        IN_MEMORY(exec_##EXEC_SUFFIX()); \
+        NEXT();                          \
+    }
+    HANDLE_SIMPLE(STA, sta)
+    HANDLE_SIMPLE(CALL_READ, call_read)
+    HANDLE_SIMPLE(CALL_WRITE, call_write)
+    HANDLE_SIMPLE(CALL_STRING, call_string)
+    HANDLE_SIMPLE(CALL_LENGTH, call_length)
+#undef HANDLE_SIMPLE
+
+    HANDLE(ELEM) {
+        auint index = POP();
+        REPLACE_TOP((auint) Belem((void *) TOP(), index));
+        NEXT();
+    }
+    HANDLE(DROP) {
+        (void) POP();
+        NEXT();
+    }
+    HANDLE(DUP) {
+        PUSH(TOP());
+        NEXT();
+    }
+    HANDLE(SWAP) {
+        IN_MEMORY(exec_swap());
+        NEXT();
+    }
+    HANDLE(CONST) {
+        PUSH(ip->arg1);
+        NEXT();
+    }
+    HANDLE(STRING) {
+        IN_MEMORY(exec_string((char *) ip->arg1));
+        NEXT();
+    }
+    HANDLE(SEXP) {
+        IN_MEMORY(exec_sexp(ip->arg1, ip->arg2));
+        NEXT();
+    }
+    HANDLE(TAG) {
+        REPLACE_TOP(Btag((void *) TOP(), ip->arg1, BOX(ip->arg2)));
+        NEXT();
+    }
+    HANDLE(ARRAY) {
+        REPLACE_TOP(Barray_patt((void *) TOP(), BOX(ip->arg1)));
+        NEXT();
+    }
+    HANDLE(CALL_ARRAY) {
+        IN_MEMORY(exec_call_array(ip->arg1));
+        NEXT();
+    }
+    HANDLE(CLOSURE) {
+        IN_MEMORY(exec_closure(code + ip->arg1, captures + ip->arg2, closure_ref));
+        NEXT();
+    }
+    HANDLE(JMP) {
+        JUMP(ip->arg1);
+    }
+    HANDLE(CJMP_Z) {
+        if (UNBOX(POP()) == 0) {
+            JUMP(ip->arg1);
+        }
+        NEXT();
+    }
+    HANDLE(CJMP_NZ) {
+        if (UNBOX(POP()) != 0) {
+            JUMP(ip->arg1);
+        }
+        NEXT();
+    }
+    HANDLE(BEGIN_COUNTED) {
+        if (++functions[ip->arg1].hotness >= functions[ip->arg1].next_tier) {
+            tier_up(ip->arg1);
+            // the function may have been compiled
+            if (ip->opcode != OP_BEGIN_COUNTED) {
+                DISPATCH();
+            }
+        }
+        goto begin;
+    }
+    HANDLE(BEGIN) {
+        begin:
+        SPILL();
+#if !CHECKED
+        // the only stack check of the frame, the verifier bounded the stack the frame may use
+        if ((size_t) (__gc_stack_top - stack_start) < functions[ip->arg1].frame_size) {
+            failure("Severity ERROR: Virtual stack limit exceeded.\n");
+        }
+#endif
+        exec_begin(ip->arg2);
+        closure_ref = frame_closure();
+#if TOS_CACHE
+        tos = BOX(0);
+#endif
+        NEXT();
+    }
+    HANDLE(CALL) {
+        IN_MEMORY(exec_call(ip + 1, ip->arg2));
+        JUMP(ip->arg1);
+    }
+    HANDLE(CALLC) {
+        // closures are values, so the verifier can't know their entries: exec_callc() checks them
+        IN_MEMORY(ip = exec_callc(&call_sites[ip->arg2], ip + 1, ip->arg1));
+        // go straight to the frame setup of a plain interpreted callee
+        if (ip->opcode == OP_BEGIN) {
+            goto begin;
+        }
+        DISPATCH();
+    }
+#if CHECKED
+// operands of a tail call have to be on the operand stack of the frame, and the frame can't be reused while
+// they refer to its slots: the verifier turns such tail calls into plain calls, unverified programs check here
+#define TAIL_CALL_KEEPS_FRAME(N_WORDS) (__gc_stack_top + (N_WORDS) > stack_fp \
+        ? (failure("Severity ERROR: Tail call operands are out of the frame.\n"), true) : frame_referenced(N_WORDS))
+#else
+#define TAIL_CALL_KEEPS_FRAME(N_WORDS) false
+#endif
+    HANDLE(TAIL_CALL) {
+        SPILL();
+        if (TAIL_CALL_KEEPS_FRAME(ip->arg2)) {
+            exec_call(ip + 1, ip->arg2);
+        } else {
+            exec_tail_call(ip->arg2, ip->arg2);
+        }
+        FILL();
+        JUMP(ip->arg1);
+    }
+    HANDLE(TAIL_CALLC) {
+        SPILL();
+        if (TAIL_CALL_KEEPS_FRAME(ip->arg1 + 1)) {
+            ip = exec_callc(&call_sites[ip->arg2], ip + 1, ip->arg1);
+        } else {
+            instruction *callee = closure_entry(&call_sites[ip->arg2], ip->arg1);
+            exec_tail_call(ip->arg1 + 1, ip->arg1 + 1);
+            ip = callee;
+        }
+        FILL();
+        if (ip->opcode == OP_BEGIN) {
+            goto begin;
+        }
+        DISPATCH();
+    }
+#undef TAIL_CALL_KEEPS_FRAME
+    HANDLE(END) {
+        SPILL();
+        ip = exec_end();
+        // END of the main function returns to the zero address pushed by init_interpreter
+        if (ip == NULL) {
+            return;
+        }
+        closure_ref = frame_closure();
+        FILL();
+        DISPATCH();
+    }
+// counts a back edge of the function ip->arg2, once it is compiled the frame continues natively from TARGET
+#define COUNT_BACK_EDGE(TARGET)                                                    \
+    do {                                                                           \
+        if (++functions[ip->arg2].hotness >= functions[ip->arg2].next_tier) {      \
+            tier_up(ip->arg2);                                                     \
+            if (functions[ip->arg2].native != NULL) {                              \
+                SPILL();                                                           \
+                ip = osr_enter(TARGET);                                            \
+                if (ip == NULL) {                                                  \
+                    return;                                                        \
+                }                                                                  \
+                closure_ref = frame_closure();                                     \
+                FILL();                                                            \
+                DISPATCH();                                                        \
+            }                                                                      \
+        }                                                                          \
+    } while (0)
+    HANDLE(JMP_BACK) {
+        COUNT_BACK_EDGE(ip->arg1);
+        JUMP(ip->arg1);
+    }
+    HANDLE(CJMP_Z_BACK) {
+        if (UNBOX(POP()) == 0) {
+            COUNT_BACK_EDGE(ip->arg1);
+            JUMP(ip->arg1);
+        }
+        NEXT();
+    }
+    HANDLE(CJMP_NZ_BACK) {
+        if (UNBOX(POP()) != 0) {
+            COUNT_BACK_EDGE(ip->arg1);
+            JUMP(ip->arg1);
+        }
+        NEXT();
+    }
+#undef COUNT_BACK_EDGE
+    HANDLE(BEGIN_NATIVE) {
+        // compiled function, its frame runs natively up to the END
+        SPILL();
+        ip = ((native_function) functions[ip->arg1].native)();
+        if (ip == NULL) {
+            return;
+        }
+        closure_ref = frame_closure();
+        FILL();
+        DISPATCH();
+    }
+    HANDLE(LINE) {
+        NEXT();
+    }
+    HANDLE(FAIL) {
+        failure("Severity RUNTIME: Failed executing FAIL %d %d.\n", (int) ip->arg1, ip->arg2);
+    }
+    HANDLE(STI) {
+        failure("Severity RUNTIME: STI bytecode is deprecated.\n");
+    }
+    HANDLE(RET) {
+        failure("Severity RUNTIME: RET bytecode has UB.\n");
+    }
+    HANDLE(STOP) {
+        failure("Severity ERROR: Unknown bytecode type.\n");
+    }
+
+    /** superinstructions */
+    HANDLE(DUP_CONST_ELEM) {
+        PUSH((auint) Belem((void *) TOP(), ip->arg1));
+        SKIP(3);
+    }
+    HANDLE(CONST_ELEM) {
+        REPLACE_TOP((auint) Belem((void *) TOP(), ip->arg1));
+        SKIP(2);
+    }
+    HANDLE(ST_LOCAL_DROP) {
+        *(stack_fp - ip->arg1 - 1) = POP();
+        SKIP(2);
+    }
+    HANDLE(DROP_DROP) {
+        (void) POP();
+        (void) POP();
+        SKIP(2);
+    }
+    HANDLE(DUP_DUP) {
+        PUSH(TOP());
+        PUSH(TOP());
+        SKIP(2);
+    }
+#define HANDLE_LD_LD(LOC1, ADDRESS1, LOC2, ADDRESS2) \
+    HANDLE(LD_##LOC1##_LD_##LOC2) {                  \
+        PUSH(*(ADDRESS1));                           \
+        PUSH(*(ADDRESS2));                           \
+        SKIP(2);                                     \
+    }
+    HANDLE_LD_LD(LOCAL, stack_fp - ip->arg1 - 1, LOCAL, stack_fp - ip->arg2 - 1)
+    HANDLE_LD_LD(LOCAL, stack_fp - ip->arg1 - 1, ARGUMENT, stack_fp + ip->arg2 + 3)
+    HANDLE_LD_LD(ARGUMENT, stack_fp + ip->arg1 + 3, LOCAL, stack_fp - ip->arg2 - 1)
+    HANDLE_LD_LD(ARGUMENT, stack_fp + ip->arg1 + 3, ARGUMENT, stack_fp + ip->arg2 + 3)
+#undef HANDLE_LD_LD
+#define HANDLE_COMPARE_JUMP(NAME, OP)   \
+    HANDLE(NAME##_CJMP_Z) {             \
+        aint b = UNBOX(POP());           \
+        aint a = UNBOX(POP());           \
+        if (!(a OP b)) {                \
+            JUMP(ip->arg1);             \
+        }                               \
+        SKIP(2);                        \
+    }                                   \
+    HANDLE(NAME##_CJMP_NZ) {            \
+        aint b = UNBOX(POP());           \
+        aint a = UNBOX(POP());           \
+        if (a OP b) {                   \
+            JUMP(ip->arg1);             \
+        }                               \
+        SKIP(2);                        \
+    }
+    HANDLE_COMPARE_JUMP(LESS, <)
+    HANDLE_COMPARE_JUMP(LESS_EQUAL, <=)
+    HANDLE_COMPARE_JUMP(GREATER, >)
+    HANDLE_COMPARE_JUMP(GREATER_EQUAL, >=)
+    HANDLE_COMPARE_JUMP(EQUAL, ==)
+    HANDLE_COMPARE_JUMP(NOT_EQUAL, !=)
+#undef HANDLE_COMPARE_JUMP
+
+#if !THREADED
+        default:
+            failure("Severity ERROR: Unknown bytecode type.\n");
+    }
+#endif
+#undef HANDLE
+#undef DISPATCH
+#undef NEXT
+#undef SKIP
+#undef JUMP
+#undef STACK_PUSH
+#undef STACK_POP
+#undef STACK_TOP
+#undef STACK_REPLACE_TOP
+#undef CLOSURE_SLOT
+#undef PUSH
+#undef POP
+#undef TOP
+#undef REPLACE_TOP
+#undef SPILL
+#undef FILL
+#undef IN_MEMORY
+}
+
+#undef INTERPRETER_NAME
+#undef THREADED
+#undef TOS_CACHE
+#undef CHECKED
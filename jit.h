@@ -0,0 +1,859 @@
+#pragma once
+
+#include <sys/mman.h>
+#include "interpreter.h"
+
+/**
+ * Baseline template JIT for i386.
+ * Translates the instructions of a function from its BEGIN up to the next function by stitching together
+ * per-opcode machine code templates. Compiled code works with the same virtual stack and frame layout as
+ * the interpreter, so frames of both kinds interleave freely and the GC scans them as before:
+ *   esi  caches __gc_stack_top, edi caches stack_fp, both are written back before every call
+ *        of a runtime function (which may run the GC) and reloaded after it,
+ *   eax, ecx, edx  scratch registers, values never stay in them across calls.
+ * Anything that allocates or inspects heap objects calls the same exec_* helpers and B* runtime functions
+ * as the interpreter. A compiled function has the signature of native_function: it returns the return
+ * address of its frame, which the interpreter continues with and compiled callers ignore.
+ * Compiled code calls interpreted functions by running a nested interpreter on a frame with the zero
+ * return address, whose END returns to the compiled caller. A tail call replaces the frame as in the
+ * interpreter and jumps to the compiled callee instead of calling it, so that the callee returns straight
+ * to the caller of the frame; a tail call of an interpreted function stays a plain call.
+ * Only verified programs are compiled: the templates rely on the frame sizes computed by the verifier.
+ */
+
+#if defined(__i386__)
+
+#define JIT_CHUNK_SIZE (4 * 1024 * 1024)
+// upper bound of the machine code size of one instruction
+#define JIT_MAX_INSTRUCTION_SIZE 128
+
+enum { EAX = 0, ECX = 1, EDX = 2, EBX = 3, ESP = 4, EBP = 5, ESI = 6, EDI = 7 };
+
+// condition codes of jcc and setcc
+enum { CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+typedef struct {
+    u_int8_t *start;
+    u_int8_t *current;
+    u_int8_t *end;
+} code_buffer;
+
+typedef struct {
+    u_int8_t *position; // rel32 operand to patch
+    u_int32_t target;   // instruction index
+} jump_fixup;
+
+typedef struct {
+    const decoded_program *program;
+    u_int8_t *current;
+    u_int32_t first;       // index of BEGIN
+    u_int32_t last;        // index after the last instruction of the function
+    jump_fixup *fixups;
+    u_int32_t fixups_number;
+} jit_compiler;
+
+static code_buffer jit_code;
+// machine code of every instruction of compiled functions, jump and on-stack replacement targets
+static u_int8_t **jit_labels;
+// enters compiled code in the middle of a function, see osr_enter()
+static instruction *(*jit_osr_stub)(u_int8_t *label);
+
+static inline void emit8(jit_compiler *c, u_int8_t byte) {
+    *c->current++ = byte;
+}
+
+static inline void emit32(jit_compiler *c, u_int32_t value) {
+    memcpy(c->current, &value, sizeof(value));
+    c->current += sizeof(value);
+}
+
+// ModRM, SIB and displacement of the operand [base + disp]
+static void emit_memory(jit_compiler *c, int reg, int base, int32_t disp) {
+    int mod = disp == 0 && base != EBP ? 0 : disp >= -128 && disp <= 127 ? 1 : 2;
+    emit8(c, (mod << 6) | (reg << 3) | (base == ESP ? 4 : base));
+    if (base == ESP) {
+        emit8(c, 0x24);
+    }
+    if (mod == 1) {
+        emit8(c, (int8_t) disp);
+    } else if (mod == 2) {
+        emit32(c, disp);
+    }
+}
+
+// mov reg, [base + disp]
+static void emit_load(jit_compiler *c, int reg, int base, int32_t disp) {
+    emit8(c, 0x8B);
+    emit_memory(c, reg, base, disp);
+}
+
+// mov [base + disp], reg
+static void emit_store(jit_compiler *c, int base, int32_t disp, int reg) {
+    emit8(c, 0x89);
+    emit_memory(c, reg, base, disp);
+}
+
+// mov dword [base + disp], imm
+static void emit_store_imm(jit_compiler *c, int base, int32_t disp, u_int32_t imm) {
+    emit8(c, 0xC7);
+    emit_memory(c, 0, base, disp);
+    emit32(c, imm);
+}
+
+// lea reg, [base + disp]
+static void emit_lea(jit_compiler *c, int reg, int base, int32_t disp) {
+    emit8(c, 0x8D);
+    emit_memory(c, reg, base, disp);
+}
+
+// mov reg, [address]
+static void emit_load_absolute(jit_compiler *c, int reg, const void *address) {
+    emit8(c, 0x8B);
+    emit8(c, (reg << 3) | 5);
+    emit32(c, (u_int32_t) address);
+}
+
+// mov [address], reg
+static void emit_store_absolute(jit_compiler *c, const void *address, int reg) {
+    emit8(c, 0x89);
+    emit8(c, (reg << 3) | 5);
+    emit32(c, (u_int32_t) address);
+}
+
+// add reg, imm (sub with the negated imm)
+static void emit_add_imm(jit_compiler *c, int reg, int32_t imm) {
+    if (imm >= -128 && imm <= 127) {
+        emit8(c, 0x83);
+        emit8(c, 0xC0 | reg);
+        emit8(c, (int8_t) imm);
+    } else {
+        emit8(c, 0x81);
+        emit8(c, 0xC0 | reg);
+        emit32(c, imm);
+    }
+}
+
+// two-register ALU instruction in the "op r/m32, r32" form: add 0x01, or 0x09, and 0x21, sub 0x29, cmp 0x39, test 0x85
+static void emit_alu(jit_compiler *c, u_int8_t opcode, int dst, int src) {
+    emit8(c, opcode);
+    emit8(c, 0xC0 | (src << 3) | dst);
+}
+
+static void emit_mov_imm(jit_compiler *c, int reg, u_int32_t imm) {
+    emit8(c, 0xB8 + reg);
+    emit32(c, imm);
+}
+
+// sar reg, 1
+static void emit_unbox(jit_compiler *c, int reg) {
+    emit8(c, 0xD1);
+    emit8(c, 0xF8 | reg);
+}
+
+// lea reg, [reg * 2 + 1]
+static void emit_box(jit_compiler *c, int reg) {
+    emit8(c, 0x8D);
+    emit8(c, (reg << 3) | 4);
+    emit8(c, 0x45 | (reg << 3));
+    emit32(c, 1);
+}
+
+// eax = cc ? 1 : 0
+static void emit_setcc(jit_compiler *c, u_int8_t cc) {
+    emit8(c, 0x0F);
+    emit8(c, 0x90 | cc);
+    emit8(c, 0xC0);
+    emit8(c, 0x0F); // movzx eax, al
+    emit8(c, 0xB6);
+    emit8(c, 0xC0);
+}
+
+static void emit_call(jit_compiler *c, const void *function) {
+    emit8(c, 0xE8);
+    emit32(c, (u_int32_t) function - (u_int32_t) (c->current + 4));
+}
+
+static void emit_jump_to(jit_compiler *c, u_int32_t target) {
+    c->fixups[c->fixups_number].position = c->current;
+    c->fixups[c->fixups_number++].target = target;
+    emit32(c, 0);
+}
+
+// jmp to the instruction with index target
+static void emit_jmp(jit_compiler *c, u_int32_t target) {
+    emit8(c, 0xE9);
+    emit_jump_to(c, target);
+}
+
+// jcc to the instruction with index target
+static void emit_jcc(jit_compiler *c, u_int8_t cc, u_int32_t target) {
+    emit8(c, 0x0F);
+    emit8(c, 0x80 | cc);
+    emit_jump_to(c, target);
+}
+
+// jcc rel8 forward, returns the position to patch with emit_bind()
+static u_int8_t *emit_jcc_forward(jit_compiler *c, u_int8_t cc) {
+    emit8(c, 0x70 | cc);
+    emit8(c, 0);
+    return c->current - 1;
+}
+
+static u_int8_t *emit_jmp_forward(jit_compiler *c) {
+    emit8(c, 0xEB);
+    emit8(c, 0);
+    return c->current - 1;
+}
+
+static void emit_bind(jit_compiler *c, u_int8_t *position) {
+    *position = c->current - position - 1;
+}
+
+// writes the cached stack registers back before calling the runtime
+static void emit_sync(jit_compiler *c) {
+    emit_store_absolute(c, &__gc_stack_top, ESI);
+    emit_store_absolute(c, &stack_fp, EDI);
+}
+
+static void emit_reload(jit_compiler *c) {
+    emit_load_absolute(c, ESI, &__gc_stack_top);
+    emit_load_absolute(c, EDI, &stack_fp);
+}
+
+// calls a function working with the virtual stack, arguments are immediates
+static void emit_stack_call(jit_compiler *c, const void *function, int argc, u_int32_t arg0, u_int32_t arg1) {
+    emit_sync(c);
+    if (argc > 0) {
+        emit_store_imm(c, ESP, 0, arg0);
+    }
+    if (argc > 1) {
+        emit_store_imm(c, ESP, 4, arg1);
+    }
+    emit_call(c, function);
+    emit_reload(c);
+}
+
+// replaces the top of the stack with function(top, extra), for runtime functions that don't allocate
+static void emit_top_call(jit_compiler *c, const void *function, int argc, u_int32_t extra0, u_int32_t extra1) {
+    emit_load(c, EAX, ESI, 0);
+    emit_store(c, ESP, 0, EAX);
+    if (argc > 1) {
+        emit_store_imm(c, ESP, 4, extra0);
+    }
+    if (argc > 2) {
+        emit_store_imm(c, ESP, 8, extra1);
+    }
+    emit_sync(c);
+    emit_call(c, function);
+    emit_reload(c);
+    emit_store(c, ESI, 0, EAX);
+}
+
+static void emit_push_eax(jit_compiler *c) {
+    emit_add_imm(c, ESI, -4);
+    emit_store(c, ESI, 0, EAX);
+}
+
+// eax = gc_read_barrier(eax) while the incremental GC is copying
+static void emit_read_barrier(jit_compiler *c) {
+    emit_load_absolute(c, ECX, &gc_collecting);
+    emit_alu(c, 0x85, ECX, ECX);
+    u_int8_t *done = emit_jcc_forward(c, CC_E);
+    emit_store(c, ESP, 0, EAX);
+    emit_call(c, gc_read_barrier);
+    emit_bind(c, done);
+}
+
+// eax = address of the captured value with the given index of the current closure
+static void emit_closure_slot(jit_compiler *c, u_int32_t index) {
+    emit_load(c, EAX, EDI, 4);
+    emit8(c, 0x8B); // mov eax, [edi + eax * 4 + 8]
+    emit8(c, 0x44);
+    emit8(c, 0x87);
+    emit8(c, 8);
+    emit_lea(c, EAX, EAX, 4 * (index + 1));
+}
+
+// sets base and disp so that [base + disp] is the variable, computes the base into eax if it is not static
+static void emit_location(jit_compiler *c, u_int32_t loc, u_int32_t index, int *base, int32_t *disp) {
+    switch (loc) {
+        case GLOBAL:
+            emit_mov_imm(c, EAX, (u_int32_t) (interpreterState.byteFile->global_ptr + index));
+            *base = EAX;
+            *disp = 0;
+            break;
+        case LOCAL:
+            *base = EDI;
+            *disp = -4 * (int32_t) (index + 1);
+            break;
+        case ARGUMENT:
+            *base = EDI;
+            *disp = 4 * (int32_t) (index + 3);
+            break;
+        default:
+            emit_closure_slot(c, index);
+            *base = EAX;
+            *disp = 0;
+            break;
+    }
+}
+
+static void jit_stack_overflow() {
+    failure("Severity ERROR: Virtual stack limit exceeded.\n");
+}
+
+static void jit_runtime_failure(const instruction *insn) {
+    switch (insn->opcode) {
+        case OP_FAIL:
+            failure("Severity RUNTIME: Failed executing FAIL %d %d.\n", insn->arg1, insn->arg2);
+        case OP_STI:
+            failure("Severity RUNTIME: STI bytecode is deprecated.\n");
+        case OP_RET:
+            failure("Severity RUNTIME: RET bytecode has UB.\n");
+        default:
+            failure("Severity ERROR: Unknown bytecode type.\n");
+    }
+}
+
+// runs a function, natively if it is compiled, the frame with arguments and the return address is pushed
+static void jit_enter(instruction *entry) {
+    native_function native = interpreterState.program->functions[entry->arg1].native;
+    if (native != NULL) {
+        native();
+    } else {
+        current_interpreter(entry);
+    }
+}
+
+static void jit_closure(instruction *entry, const u_int32_t *captures) {
+    exec_closure(entry, captures, frame_closure());
+}
+
+static void jit_callc(u_int32_t n_args, call_site *site) {
+    jit_enter(exec_callc(site, NULL, n_args));
+}
+
+// replaces the frame with the frame of a compiled callee and returns its code to jump to,
+// calls an interpreted callee as jit_callc() does and returns NULL
+static native_function jit_tail_callc(u_int32_t n_args, call_site *site) {
+    instruction *entry = closure_entry(site, n_args);
+    native_function native = interpreterState.program->functions[entry->arg1].native;
+    if (native == NULL) {
+        exec_call(NULL, n_args + 1);
+        current_interpreter(entry);
+        return NULL;
+    }
+    exec_tail_call(n_args + 1, n_args + 1);
+    return native;
+}
+
+// the plain instruction the opcode is compiled as: counting variants of tiered execution are compiled
+// as their originals, superinstructions as their first instruction (the rest stays in the following slots)
+static u_int32_t base_opcode(u_int32_t opcode) {
+    switch (opcode) {
+        case OP_BEGIN_COUNTED:
+            return OP_BEGIN;
+        case OP_JMP_BACK:
+            return OP_JMP;
+        case OP_CJMP_Z_BACK:
+            return OP_CJMP_Z;
+        case OP_CJMP_NZ_BACK:
+            return OP_CJMP_NZ;
+    }
+    for (size_t k = 0; k < sizeof(superinstructions) / sizeof(superinstruction); ++k) {
+        if (superinstructions[k].fused == opcode) {
+            return superinstructions[k].sequence[0];
+        }
+    }
+    return opcode;
+}
+
+static void emit_binop(jit_compiler *c, u_int32_t opcode) {
+    emit_load(c, ECX, ESI, 0);
+    emit_add_imm(c, ESI, 4);
+    emit_load(c, EAX, ESI, 0);
+    switch (opcode) {
+        case OP_BINOP_PLUS:
+            // tagged addition: (2a + 1) + (2b + 1) - 1 = 2(a + b) + 1
+            emit_alu(c, 0x01, EAX, ECX);
+            emit_add_imm(c, EAX, -1);
+            break;
+        case OP_BINOP_MINUS:
+            emit_alu(c, 0x29, EAX, ECX);
+            emit_add_imm(c, EAX, 1);
+            break;
+        default:
+            emit_unbox(c, EAX);
+            emit_unbox(c, ECX);
+            switch (opcode) {
+                case OP_BINOP_MULTIPLY:
+                    emit8(c, 0x0F); // imul eax, ecx
+                    emit8(c, 0xAF);
+                    emit8(c, 0xC1);
+                    break;
+                case OP_BINOP_DIVIDE:
+                case OP_BINOP_REMAINDER:
+                    emit8(c, 0x99); // cdq
+                    emit8(c, 0xF7); // idiv ecx
+                    emit8(c, 0xF9);
+                    if (opcode == OP_BINOP_REMAINDER) {
+                        emit8(c, 0x89); // mov eax, edx
+                        emit8(c, 0xD0);
+                    }
+                    break;
+                case OP_BINOP_AND:
+                case OP_BINOP_OR:
+                    emit_alu(c, 0x85, ECX, ECX);
+                    emit8(c, 0x0F); // setne cl
+                    emit8(c, 0x95);
+                    emit8(c, 0xC1);
+                    emit_alu(c, 0x85, EAX, EAX);
+                    emit8(c, 0x0F); // setne al
+                    emit8(c, 0x95);
+                    emit8(c, 0xC0);
+                    emit8(c, opcode == OP_BINOP_AND ? 0x20 : 0x08); // and/or al, cl
+                    emit8(c, 0xC8);
+                    emit8(c, 0x0F); // movzx eax, al
+                    emit8(c, 0xB6);
+                    emit8(c, 0xC0);
+                    break;
+                default: {
+                    static const u_int8_t conditions[] = {CC_L, CC_LE, CC_G, CC_GE, CC_E, CC_NE};
+                    emit_alu(c, 0x39, EAX, ECX);
+                    emit_setcc(c, conditions[opcode - OP_BINOP_LESS]);
+                    break;
+                }
+            }
+            emit_box(c, EAX);
+            break;
+    }
+    emit_store(c, ESI, 0, EAX);
+}
+
+static void emit_begin(jit_compiler *c, const instruction *insn) {
+    const function_info *function = &c->program->functions[insn->arg1];
+    // the only stack check of the frame, as in the unchecked interpreters
+    emit_lea(c, EAX, ESI, -4 * (int32_t) function->frame_size);
+    emit8(c, 0x3B); // cmp eax, [stack_start]
+    emit8(c, (EAX << 3) | 5);
+    emit32(c, (u_int32_t) &stack_start);
+    u_int8_t *enough = emit_jcc_forward(c, 0x3); // jae
+    emit_call(c, jit_stack_overflow);
+    emit_bind(c, enough);
+    // exec_begin()
+    emit_add_imm(c, ESI, -4);
+    emit_store(c, ESI, 0, EDI);
+    emit8(c, 0x89); // mov edi, esi
+    emit8(c, 0xF7);
+    if (insn->arg2 <= 8) {
+        emit_add_imm(c, ESI, -4 * (int32_t) insn->arg2);
+        for (u_int32_t i = 0; i < insn->arg2; ++i) {
+            emit_store_imm(c, ESI, 4 * i, BOX(0));
+        }
+    } else {
+        emit_mov_imm(c, ECX, insn->arg2);
+        u_int8_t *loop = c->current;
+        emit_add_imm(c, ESI, -4);
+        emit_store_imm(c, ESI, 0, BOX(0));
+        emit8(c, 0x49); // dec ecx
+        emit8(c, 0x75); // jnz loop
+        emit8(c, loop - (c->current + 1));
+    }
+}
+
+// restores the registers saved by emit_prologue()
+static void emit_epilogue(jit_compiler *c) {
+    emit8(c, 0x8D); // lea esp, [ebp - 8]
+    emit8(c, 0x65);
+    emit8(c, 0xF8);
+    emit8(c, 0x5F); // pop edi
+    emit8(c, 0x5E); // pop esi
+    emit8(c, 0x5D); // pop ebp
+}
+
+static void emit_end(jit_compiler *c) {
+    // exec_end(): the return value replaces the frame with its arguments, the return address goes to eax
+    emit_load(c, EAX, ESI, 0);
+    emit8(c, 0x89); // mov esi, edi
+    emit8(c, 0xFE);
+    emit_load(c, EDI, ESI, 0);
+    emit_load(c, ECX, ESI, 4);
+    emit_load(c, EDX, ESI, 8);
+    emit8(c, 0x8D); // lea esi, [esi + ecx * 4 + 8]
+    emit8(c, 0x74);
+    emit8(c, 0x8E);
+    emit8(c, 8);
+    emit_store(c, ESI, 0, EAX);
+    emit_sync(c);
+    emit8(c, 0x89); // mov eax, edx
+    emit8(c, 0xD0);
+    emit_epilogue(c);
+    emit8(c, 0xC3); // ret
+}
+
+static void emit_call_function(jit_compiler *c, const instruction *insn) {
+    const instruction *entry = &c->program->code[insn->arg1];
+    u_int32_t n_args = insn->arg2;
+    // exec_call() with the zero return address
+    emit_add_imm(c, ESI, -8);
+    emit_store_imm(c, ESI, 4, 0);
+    emit_store_imm(c, ESI, 0, n_args);
+    emit_sync(c);
+    // compiled callees are called directly, the others run in a nested interpreter
+    emit_load_absolute(c, EAX, &c->program->functions[entry->arg1].native);
+    emit_alu(c, 0x85, EAX, EAX);
+    u_int8_t *interpreted = emit_jcc_forward(c, CC_E);
+    emit8(c, 0xFF); // call eax
+    emit8(c, 0xD0);
+    u_int8_t *done = emit_jmp_forward(c);
+    emit_bind(c, interpreted);
+    emit_store_imm(c, ESP, 0, (u_int32_t) entry);
+    emit_call(c, jit_enter);
+    emit_bind(c, done);
+    emit_reload(c);
+}
+
+// leaves the frame after the tail call replaced it: the callee in eax returns to the caller of this code
+static void emit_tail_jump(jit_compiler *c) {
+    emit_epilogue(c);
+    emit8(c, 0xFF); // jmp eax
+    emit8(c, 0xE0);
+}
+
+static void emit_tail_call_function(jit_compiler *c, const instruction *insn) {
+    u_int32_t n_args = insn->arg2;
+    // a self call becomes a jump to BEGIN, which sets up the replaced frame again
+    if (insn->arg1 == c->first) {
+        emit_stack_call(c, exec_tail_call, 2, n_args, n_args);
+        emit_jmp(c, c->first);
+        return;
+    }
+    const void *native = &c->program->functions[c->program->code[insn->arg1].arg1].native;
+    emit_load_absolute(c, EAX, native);
+    emit_alu(c, 0x85, EAX, EAX);
+    u_int8_t *interpreted = emit_jcc_forward(c, CC_E);
+    emit_stack_call(c, exec_tail_call, 2, n_args, n_args);
+    emit_load_absolute(c, EAX, native);
+    emit_tail_jump(c);
+    // END in the next slot returns the result of the plain call
+    emit_bind(c, interpreted);
+    emit_call_function(c, insn);
+}
+
+// comparison fused with the conditional jump after it, which stays compiled in its slot for jumps into it
+static void emit_compare_jump(jit_compiler *c, const instruction *insn, u_int32_t index) {
+    static const u_int8_t conditions[] = {CC_L, CC_LE, CC_G, CC_GE, CC_E, CC_NE};
+    u_int32_t fused = insn->opcode - OP_LESS_CJMP_Z;
+    u_int8_t cc = conditions[fused / 2];
+    emit_load(c, ECX, ESI, 0);
+    emit_load(c, EAX, ESI, 4);
+    emit_add_imm(c, ESI, 8);
+    emit_unbox(c, EAX);
+    emit_unbox(c, ECX);
+    emit_alu(c, 0x39, EAX, ECX);
+    // CJMP_Z jumps if the comparison is false, a negated condition differs in the lowest bit
+    emit_jcc(c, fused % 2 == 0 ? cc ^ 1 : cc, insn->arg1);
+    emit_jmp(c, index + 2);
+}
+
+static void emit_instruction(jit_compiler *c, u_int32_t index) {
+    const instruction *insn = &c->program->code[index];
+    if (is_compare_jump(insn->opcode)) {
+        emit_compare_jump(c, insn, index);
+        return;
+    }
+    u_int32_t opcode = base_opcode(insn->opcode);
+    int base;
+    int32_t disp;
+    switch (opcode) {
+        case OP_BINOP_PLUS ... OP_BINOP_OR:
+            emit_binop(c, opcode);
+            break;
+        case OP_LD_GLOBAL ... OP_LD_CLOJURE:
+            emit_location(c, opcode - OP_LD_GLOBAL, insn->arg1, &base, &disp);
+            emit_load(c, EAX, base, disp);
+            if (opcode == OP_LD_CLOJURE) {
+                emit_read_barrier(c);
+            }
+            emit_push_eax(c);
+            break;
+        case OP_LDA_GLOBAL ... OP_LDA_CLOJURE:
+            emit_location(c, opcode - OP_LDA_GLOBAL, insn->arg1, &base, &disp);
+            emit_lea(c, EAX, base, disp);
+            emit_push_eax(c);
+            break;
+        case OP_ST_GLOBAL ... OP_ST_CLOJURE:
+            emit_location(c, opcode - OP_ST_GLOBAL, insn->arg1, &base, &disp);
+            emit_load(c, ECX, ESI, 0);
+            emit_store(c, base, disp, ECX);
+            if (opcode == OP_ST_CLOJURE) {
+                // the closure slot address is in eax
+                emit_store(c, ESP, 0, EAX);
+                emit_store(c, ESP, 4, ECX);
+                emit_call(c, gc_write_barrier);
+            }
+            break;
+        case OP_PATT_STR:
+            emit_load(c, EAX, ESI, 0);
+            emit_add_imm(c, ESI, 4);
+            emit_load(c, ECX, ESI, 0);
+            emit_store(c, ESP, 0, EAX);
+            emit_store(c, ESP, 4, ECX);
+            emit_call(c, Bstring_patt);
+            emit_store(c, ESI, 0, EAX);
+            break;
+        case OP_PATT_TAG_STR:
+            emit_top_call(c, Bstring_tag_patt, 1, 0, 0);
+            break;
+        case OP_PATT_TAG_ARR:
+            emit_top_call(c, Barray_tag_patt, 1, 0, 0);
+            break;
+        case OP_PATT_TAG_SEXP:
+            emit_top_call(c, Bsexp_tag_patt, 1, 0, 0);
+            break;
+        case OP_PATT_BOXED:
+            emit_top_call(c, Bboxed_patt, 1, 0, 0);
+            break;
+        case OP_PATT_UNBOXED:
+            emit_top_call(c, Bunboxed_patt, 1, 0, 0);
+            break;
+        case OP_PATT_TAG_CLOSURE:
+            emit_top_call(c, Bclosure_tag_patt, 1, 0, 0);
+            break;
+        case OP_CONST:
+            emit_add_imm(c, ESI, -4);
+            emit_store_imm(c, ESI, 0, insn->arg1);
+            break;
+        case OP_STRING:
+            emit_stack_call(c, exec_string, 1, insn->arg1, 0);
+            break;
+        case OP_SEXP:
+            emit_stack_call(c, exec_sexp, 2, insn->arg1, insn->arg2);
+            break;
+        case OP_STA:
+            emit_stack_call(c, exec_sta, 0, 0, 0);
+            break;
+        case OP_JMP:
+            emit_jmp(c, insn->arg1);
+            break;
+        case OP_CJMP_Z:
+        case OP_CJMP_NZ:
+            emit_load(c, EAX, ESI, 0);
+            emit_add_imm(c, ESI, 4);
+            emit_unbox(c, EAX);
+            emit_alu(c, 0x85, EAX, EAX);
+            emit_jcc(c, opcode == OP_CJMP_Z ? CC_E : CC_NE, insn->arg1);
+            break;
+        case OP_ELEM:
+            emit_load(c, EAX, ESI, 0);
+            emit_add_imm(c, ESI, 4);
+            emit_load(c, ECX, ESI, 0);
+            emit_store(c, ESP, 4, EAX);
+            emit_store(c, ESP, 0, ECX);
+            emit_call(c, Belem);
+            emit_store(c, ESI, 0, EAX);
+            break;
+        case OP_BEGIN:
+            emit_begin(c, insn);
+            break;
+        case OP_CALL:
+            emit_call_function(c, insn);
+            break;
+        case OP_CALLC:
+            emit_stack_call(c, jit_callc, 2, insn->arg1, (u_int32_t) &c->program->call_sites[insn->arg2]);
+            break;
+        case OP_TAIL_CALL:
+            emit_tail_call_function(c, insn);
+            break;
+        case OP_TAIL_CALLC: {
+            emit_stack_call(c, jit_tail_callc, 2, insn->arg1, (u_int32_t) &c->program->call_sites[insn->arg2]);
+            emit_alu(c, 0x85, EAX, EAX);
+            u_int8_t *interpreted = emit_jcc_forward(c, CC_E);
+            emit_tail_jump(c);
+            emit_bind(c, interpreted);
+            break;
+        }
+        case OP_CALL_READ:
+            emit_stack_call(c, exec_call_read, 0, 0, 0);
+            break;
+        case OP_CALL_WRITE:
+            emit_stack_call(c, exec_call_write, 0, 0, 0);
+            break;
+        case OP_CALL_STRING:
+            emit_stack_call(c, exec_call_string, 0, 0, 0);
+            break;
+        case OP_CALL_LENGTH:
+            emit_stack_call(c, exec_call_length, 0, 0, 0);
+            break;
+        case OP_CALL_ARRAY:
+            emit_stack_call(c, exec_call_array, 1, insn->arg1, 0);
+            break;
+        case OP_END:
+            emit_end(c);
+            break;
+        case OP_DROP:
+            emit_add_imm(c, ESI, 4);
+            break;
+        case OP_DUP:
+            emit_load(c, EAX, ESI, 0);
+            emit_push_eax(c);
+            break;
+        case OP_SWAP:
+            emit_load(c, EAX, ESI, 0);
+            emit_load(c, ECX, ESI, 4);
+            emit_store(c, ESI, 0, ECX);
+            emit_store(c, ESI, 4, EAX);
+            break;
+        case OP_TAG:
+            emit_top_call(c, Btag, 3, insn->arg1, BOX(insn->arg2));
+            break;
+        case OP_ARRAY:
+            emit_top_call(c, Barray_patt, 2, BOX(insn->arg1), 0);
+            break;
+        case OP_CLOSURE:
+            emit_stack_call(c, jit_closure, 2, (u_int32_t) (c->program->code + insn->arg1),
+                            (u_int32_t) (c->program->captures + insn->arg2));
+            break;
+        case OP_LINE:
+            break;
+        default:
+            emit_sync(c);
+            emit_store_imm(c, ESP, 0, (u_int32_t) insn);
+            emit_call(c, jit_runtime_failure);
+            break;
+    }
+}
+
+static u_int8_t *jit_allocate(size_t size) {
+    if (jit_code.start == NULL || jit_code.current + size > jit_code.end) {
+        size_t chunk_size = size > JIT_CHUNK_SIZE ? size : JIT_CHUNK_SIZE;
+        u_int8_t *chunk = mmap(NULL, chunk_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS,
+                               -1, 0);
+        if (chunk == MAP_FAILED) {
+            failure("Severity ERROR: Can't allocate memory for compiled code.\n");
+        }
+        jit_code.start = jit_code.current = chunk;
+        jit_code.end = chunk + chunk_size;
+    }
+    return jit_code.current;
+}
+
+// callee-saved registers and the outgoing argument area, esp stays 16-byte aligned at calls,
+// the END template restores them
+static void emit_prologue(jit_compiler *c) {
+    emit8(c, 0x55); // push ebp
+    emit8(c, 0x89); // mov ebp, esp
+    emit8(c, 0xE5);
+    emit8(c, 0x56); // push esi
+    emit8(c, 0x57); // push edi
+    emit_add_imm(c, ESP, -16);
+}
+
+// instruction *stub(u_int8_t *label): sets up a frame of compiled code and jumps to the label,
+// whose function returns from the stub at its END
+static void jit_emit_osr_stub() {
+    jit_compiler c = {.current = jit_allocate(64)};
+    jit_osr_stub = (instruction *(*)(u_int8_t *)) c.current;
+    emit_prologue(&c);
+    emit_reload(&c);
+    emit_load(&c, EAX, EBP, 8);
+    emit8(&c, 0xFF); // jmp eax
+    emit8(&c, 0xE0);
+    jit_code.current = c.current;
+}
+
+// on-stack replacement: an interpreted frame of a compiled function continues natively from the target,
+// which is possible because compiled code keeps the frame and operand stack layout of the interpreter
+instruction *osr_enter(u_int32_t target) {
+    if (jit_osr_stub == NULL) {
+        jit_emit_osr_stub();
+    }
+    return jit_osr_stub(jit_labels[target]);
+}
+
+// compiles the function, returns false if its code can't be compiled on its own
+bool jit_compile_function(decoded_program *program, u_int32_t function) {
+    jit_compiler c = {.program = program, .first = program->functions[function].entry};
+    c.last = function + 1 < program->functions_number ? program->functions[function + 1].entry : program->length;
+    u_int32_t length = c.last - c.first;
+    size_t max_size = 64;
+    for (u_int32_t i = c.first; i < c.last; ++i) {
+        // jumps out of the range would need labels of another function
+        u_int32_t opcode = base_opcode(program->code[i].opcode);
+        if ((opcode == OP_JMP || opcode == OP_CJMP_Z || opcode == OP_CJMP_NZ)
+            && (program->code[i].arg1 < c.first || program->code[i].arg1 >= c.last)) {
+            return false;
+        }
+        if (is_compare_jump(program->code[i].opcode) && i + 2 >= c.last) {
+            return false;
+        }
+        // a tail call has the code of a plain call too
+        max_size += JIT_MAX_INSTRUCTION_SIZE + (opcode == OP_BEGIN ? 16 : 0)
+                    + (opcode == OP_TAIL_CALL ? JIT_MAX_INSTRUCTION_SIZE : 0);
+    }
+    // a fused comparison and jump has two
+    c.fixups = malloc(2 * length * sizeof(jump_fixup));
+    if (jit_labels == NULL) {
+        jit_labels = calloc(program->length, sizeof(u_int8_t *));
+    }
+    if (c.fixups == NULL || jit_labels == NULL) {
+        failure("Severity ERROR: Can't allocate memory.\n");
+    }
+    u_int8_t *start = c.current = jit_allocate(max_size);
+    emit_prologue(&c);
+    emit_reload(&c);
+    for (u_int32_t i = c.first; i < c.last; ++i) {
+        jit_labels[i] = c.current;
+        emit_instruction(&c, i);
+    }
+    for (u_int32_t i = 0; i < c.fixups_number; ++i) {
+        u_int32_t rel = jit_labels[c.fixups[i].target] - (c.fixups[i].position + 4);
+        memcpy(c.fixups[i].position, &rel, sizeof(rel));
+    }
+    jit_code.current = c.current;
+    free(c.fixups);
+
+    program->functions[function].native = start;
+    instruction *begin = &program->code[c.first];
+    begin->opcode = OP_BEGIN_NATIVE;
+#ifdef __GNUC__
+    if (threaded_handlers != NULL) {
+        begin->handler = threaded_handlers[OP_BEGIN_NATIVE];
+    }
+#endif
+    return true;
+}
+
+// compiles all functions of a verified program
+void jit_compile_program(decoded_program *program) {
+    if (!program->verified) {
+        fprintf(stderr, "Severity WARNING: Only verified bytecode is compiled, running interpreted.\n");
+        return;
+    }
+    for (u_int32_t f = 0; f < program->functions_number; ++f) {
+        jit_compile_function(program, f);
+    }
+}
+
+#else
+
+// the templates are i386 code, other builds keep every function interpreted
+
+instruction *osr_enter(u_int32_t target) {
+    (void) target;
+    failure("Severity ERROR: No compiled code to enter.\n");
+    return NULL;
+}
+
+bool jit_compile_function(decoded_program *program, u_int32_t function) {
+    (void) program;
+    (void) function;
+    return false;
+}
+
+void jit_compile_program(decoded_program *program) {
+    (void) program;
+    fprintf(stderr, "Severity WARNING: The JIT only emits i386 code, running interpreted.\n");
+}
+
+#endif
@@ -1,17 +1,177 @@
 #include "byte_file.h"
 #include "string.h"
 #include "assert.h"
+#include "optimizer.h"
+#include "predecoder.h"
+#include "verifier.h"
 #include "interpreter.h"
+#include "jit.h"
+#include "tiering.h"
+#include "compiler.h"
 #include "analyzer/analyzer.h"
 
+static dispatch_mode parse_dispatch(const char *value) {
+    if (strcmp(value, "switch") == 0) {
+        return DISPATCH_SWITCH;
+    } else if (strcmp(value, "threaded") == 0) {
+        return DISPATCH_THREADED;
+    }
+    failure("Severity ERROR: Unknown dispatch mode %s.\n", value);
+}
+
+static void parse_gc(const char *value) {
+    if (strcmp(value, "generational") == 0) {
+        gc_set_generational();
+    } else if (strcmp(value, "incremental") == 0) {
+        gc_set_incremental();
+    } else if (strcmp(value, "semispace") != 0) {
+        failure("Severity ERROR: Unknown GC mode %s.\n", value);
+    }
+}
+
+// --gc-threads=<number of threads copying the heap>
+static void parse_gc_threads(const char *value) {
+    char *end;
+    unsigned long n = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || n == 0) {
+        failure("Severity ERROR: Unknown number of GC threads %s.\n", value);
+    }
+    gc_set_threads(n);
+}
+
+// --gc-budget=<fields copied per step of the incremental GC>
+static void parse_gc_budget(const char *value) {
+    char *end;
+    unsigned long words = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || words == 0) {
+        failure("Severity ERROR: Unknown GC pause budget %s.\n", value);
+    }
+    gc_set_pause_budget(words);
+}
+
+// --gc-max-heap=<heap limit in megabytes>
+static void parse_gc_max_heap(const char *value) {
+    char *end;
+    unsigned long megabytes = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || megabytes == 0) {
+        failure("Severity ERROR: Unknown heap limit %s.\n", value);
+    }
+    gc_set_heap_limit(megabytes < SIZE_MAX >> 20 ? megabytes << 20 : SIZE_MAX);
+}
+
+// --gc-stats or --gc-stats=<text|json>
+static void parse_gc_stats(const char *value) {
+    if (*value == '\0' || strcmp(value, "=text") == 0) {
+        gc_set_stats(GC_STATS_TEXT);
+    } else if (strcmp(value, "=json") == 0) {
+        gc_set_stats(GC_STATS_JSON);
+    } else {
+        failure("Severity ERROR: Unknown GC statistics format %s.\n", value);
+    }
+}
+
+// --tiered or --tiered=<superinstructions threshold>,<jit threshold>
+static void parse_tiering(const char *value) {
+    tiering.enabled = true;
+    if (*value == '\0') {
+        return;
+    }
+    char *end;
+    if (*value == '=') {
+        tiering.superinstructions_threshold = strtoul(value + 1, &end, 10);
+        if (*end == ',') {
+            tiering.jit_threshold = strtoul(end + 1, &end, 10);
+            if (*end == '\0') {
+                return;
+            }
+        }
+    }
+    failure("Severity ERROR: Unknown tiering thresholds %s.\n", value);
+}
+
+// usage: lama-vm <interpret|analyze|compile> [options] <path_to_bc_file>
 int main(int argc, char *argv[]) {
-    assert(argc == 3);
-    byte_file *bf = read_file(argv[2]);
+    assert(argc >= 3);
+    interpreter_options options = {.dispatch = DEFAULT_DISPATCH, .stack_cache = false, .checked = false};
+    bool superinstructions = true;
+    bool jit = false;
+    bool sequences = false;
+    bool optimize = true;
+    bool dump = false;
+    for (int i = 2; i < argc - 1; ++i) {
+        if (strncmp(argv[i], "--dispatch=", strlen("--dispatch=")) == 0) {
+            options.dispatch = parse_dispatch(argv[i] + strlen("--dispatch="));
+        } else if (strncmp(argv[i], "--gc=", strlen("--gc=")) == 0) {
+            parse_gc(argv[i] + strlen("--gc="));
+        } else if (strncmp(argv[i], "--gc-threads=", strlen("--gc-threads=")) == 0) {
+            parse_gc_threads(argv[i] + strlen("--gc-threads="));
+        } else if (strncmp(argv[i], "--gc-budget=", strlen("--gc-budget=")) == 0) {
+            parse_gc_budget(argv[i] + strlen("--gc-budget="));
+        } else if (strncmp(argv[i], "--gc-max-heap=", strlen("--gc-max-heap=")) == 0) {
+            parse_gc_max_heap(argv[i] + strlen("--gc-max-heap="));
+        } else if (strncmp(argv[i], "--gc-stats", strlen("--gc-stats")) == 0) {
+            parse_gc_stats(argv[i] + strlen("--gc-stats"));
+        } else if (strcmp(argv[i], "--stack-cache") == 0) {
+            options.stack_cache = true;
+        } else if (strcmp(argv[i], "--checked") == 0) {
+            options.checked = true;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jit = true;
+        } else if (strncmp(argv[i], "--tiered", strlen("--tiered")) == 0) {
+            parse_tiering(argv[i] + strlen("--tiered"));
+        } else if (strcmp(argv[i], "--no-superinstructions") == 0) {
+            superinstructions = false;
+        } else if (strcmp(argv[i], "--no-optimize") == 0) {
+            optimize = false;
+        } else if (strcmp(argv[i], "--sequences") == 0) {
+            sequences = true;
+        } else if (strcmp(argv[i], "--dump") == 0) {
+            dump = true;
+        } else {
+            failure("Severity ERROR: Unknown option %s.\n", argv[i]);
+        }
+    }
+    byte_file *bf = read_file(argv[argc - 1]);
     if (strcmp(argv[1], "interpret") == 0) {
-        init_interpreter(bf);
-        interpret();
+        if (optimize) {
+            optimize_bytecode(bf);
+        }
+        decoded_program *program = predecode(bf);
+        if (!options.checked && !verify_program(program)) {
+            fprintf(stderr, "Severity WARNING: Bytecode is not verified, %s. Running with checks.\n",
+                    verification_error);
+        }
+        if (tiering.enabled) {
+            tiering.superinstructions = superinstructions;
+            tiering.jit = program->verified;
+            tiering_init(program);
+        } else if (superinstructions) {
+            select_superinstructions(program, 0, program->length);
+        }
+        init_interpreter(program);
+        if (jit && !tiering.enabled) {
+            jit_compile_program(program);
+        }
+        run_interpreter(options);
+    } else if (strcmp(argv[1], "compile") == 0) {
+        if (optimize) {
+            optimize_bytecode(bf);
+        }
+        decoded_program *program = predecode(bf);
+        verify_program(program);
+        compile_program(stdout, program);
     } else if (strcmp(argv[1], "analyze") == 0) {
-        analyze_bytecode_frequency(stdout, bf);
+        if (dump) {
+            // the bytecode as it is executed
+            if (optimize) {
+                optimize_bytecode(bf);
+            }
+            dump_bytecode(stdout, bf);
+        } else if (sequences) {
+            analyze_bytecode_sequences(stdout, bf);
+        } else {
+            analyze_bytecode_frequency(stdout, bf);
+        }
     }
     return 0;
 }
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <stdbool.h>
+#include "byte_file.h"
+#include "bytecode_decoder.h"
+#include "predecoder.h"
+#include "analyzer/analyzer.h"
+
+/**
+ * Peephole optimizer over the bytecode of a byte_file, run after read_file() and before pre-decoding.
+ * Rewrites inside basic blocks (see find_basic_block_leaders()):
+ *   CONST a; CONST b; BINOP op       -> CONST (a op b)
+ *   DUP; DROP                        -> (nothing)
+ *   ST x; DROP; LD x                 -> ST x
+ *   CONST 0; BINOP ==; CJMPz l       -> CJMPnz l, and the other combinations of ==, != and CJMPz, CJMPnz
+ *   JMP l, where l: JMP m            -> JMP m, for conditional jumps too
+ *   JMP to the next instruction      -> (nothing)
+ * Every rewrite keeps the stack effect of the sequence, so jumps to a removed instruction go to the next kept one.
+ * Removed instructions are dropped from the code and all code offsets are adjusted.
+ */
+
+typedef struct {
+    u_int32_t offset; // in the original code
+    u_int32_t size;
+    u_int8_t bytecode;
+    // the first operand: constant, or the original offset of a jump, call or closure target
+    int32_t operand;
+    // the first instruction of a basic block, sequences only start at it
+    bool leader;
+    bool removed;
+} peephole_instruction;
+
+typedef struct {
+    peephole_instruction *code;
+    u_int32_t length;
+    // instruction index by original offset
+    u_int32_t *index_of;
+    bool changed;
+} peephole_state;
+
+static bool has_code_target(u_int8_t bytecode) {
+    return bytecode == JMP || bytecode == CJMP_Z || bytecode == CJMP_NZ || bytecode == CALL || bytecode == CLOSURE;
+}
+
+// index of the first kept instruction starting from i, length if there is none
+static u_int32_t next_kept(const peephole_state *s, u_int32_t i) {
+    while (i < s->length && s->code[i].removed) {
+        ++i;
+    }
+    return i;
+}
+
+static u_int32_t target_index(const peephole_state *s, const peephole_instruction *insn) {
+    return next_kept(s, s->index_of[insn->operand]);
+}
+
+// jumps to a removed instruction land on the next kept one, which starts a basic block from now on
+static void remove_instruction(peephole_state *s, u_int32_t i) {
+    s->code[i].removed = true;
+    s->changed = true;
+    u_int32_t next = next_kept(s, i + 1);
+    if (s->code[i].leader && next < s->length) {
+        s->code[next].leader = true;
+    }
+}
+
+// fills the following kept instructions of a sequence starting at i, fails at a basic block boundary
+static bool peephole_window(const peephole_state *s, u_int32_t i, u_int32_t *window, int size) {
+    window[0] = i;
+    for (int k = 1; k < size; ++k) {
+        window[k] = next_kept(s, window[k - 1] + 1);
+        if (window[k] >= s->length || s->code[window[k]].leader) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// folds the binop with the semantics of the interpreter: operands and the result are integers of a word without
+// the tag bit, 31 or 63 bits (see runtime.h); a result that doesn't fit the operand of CONST is left unfolded
+static bool fold_binop(u_int8_t binop, int32_t a, int32_t b, int32_t *result) {
+    auint x = UNBOX(BOX(a));
+    auint y = UNBOX(BOX(b));
+    aint r;
+    switch (binop) {
+        case PLUS:
+            r = (aint) (x + y);
+            break;
+        case MINUS:
+            r = (aint) (x - y);
+            break;
+        case MULTIPLY:
+            r = (aint) (x * y);
+            break;
+        case DIVIDE:
+        case REMAINDER:
+            // division by zero is left to fail at run time
+            if (y == 0) {
+                return false;
+            }
+            r = binop == DIVIDE ? (aint) x / (aint) y : (aint) x % (aint) y;
+            break;
+        case LESS:
+            r = (aint) x < (aint) y;
+            break;
+        case LESS_EQUAL:
+            r = (aint) x <= (aint) y;
+            break;
+        case GREATER:
+            r = (aint) x > (aint) y;
+            break;
+        case GREATER_EQUAL:
+            r = (aint) x >= (aint) y;
+            break;
+        case EQUAL:
+            r = x == y;
+            break;
+        case NOT_EQUAL:
+            r = x != y;
+            break;
+        case AND:
+            r = x && y;
+            break;
+        case OR:
+            r = x || y;
+            break;
+        default:
+            return false;
+    }
+    r = UNBOX(BOX(r));
+    if (r < INT32_MIN || r > INT32_MAX) {
+        return false;
+    }
+    *result = (int32_t) r;
+    return true;
+}
+
+static void peephole_sequences(peephole_state *s, u_int32_t i) {
+    peephole_instruction *code = s->code;
+    u_int32_t w[3];
+    u_int8_t bytecode = code[i].bytecode;
+    if (bytecode == CONST && peephole_window(s, i, w, 3) && code[w[1]].bytecode == CONST
+        && high_bits(code[w[2]].bytecode) == BINOP_HIGH_BITS) {
+        int32_t result;
+        if (fold_binop(low_bits(code[w[2]].bytecode), code[i].operand, code[w[1]].operand, &result)) {
+            code[i].operand = result;
+            remove_instruction(s, w[1]);
+            remove_instruction(s, w[2]);
+            return;
+        }
+    }
+    if (bytecode == CONST && code[i].operand == 0 && peephole_window(s, i, w, 3)
+        && (code[w[1]].bytecode == (BINOP | EQUAL) || code[w[1]].bytecode == (BINOP | NOT_EQUAL))
+        && (code[w[2]].bytecode == CJMP_Z || code[w[2]].bytecode == CJMP_NZ)) {
+        // the conditional jumps already test against zero, x == 0 just inverts them
+        if (code[w[1]].bytecode == (BINOP | EQUAL)) {
+            code[w[2]].bytecode = code[w[2]].bytecode == CJMP_Z ? CJMP_NZ : CJMP_Z;
+        }
+        remove_instruction(s, i);
+        remove_instruction(s, w[1]);
+        return;
+    }
+    if (bytecode == DUP && peephole_window(s, i, w, 2) && code[w[1]].bytecode == DROP) {
+        remove_instruction(s, i);
+        remove_instruction(s, w[1]);
+        return;
+    }
+    if (high_bits(bytecode) == ST_HIGH_BITS && peephole_window(s, i, w, 3) && code[w[1]].bytecode == DROP
+        && code[w[2]].bytecode == (LD | low_bits(bytecode)) && code[w[2]].operand == code[i].operand) {
+        remove_instruction(s, w[1]);
+        remove_instruction(s, w[2]);
+        return;
+    }
+}
+
+static void peephole_jump(peephole_state *s, u_int32_t i) {
+    peephole_instruction *insn = &s->code[i];
+    // a bounded number of steps, chains of jumps may form a cycle
+    for (int steps = 0; steps < 16; ++steps) {
+        u_int32_t target = target_index(s, insn);
+        if (target >= s->length || target == i || s->code[target].bytecode != JMP) {
+            break;
+        }
+        if (s->code[target].operand == insn->operand) {
+            break;
+        }
+        insn->operand = s->code[target].operand;
+        s->changed = true;
+    }
+    if (insn->bytecode == JMP && target_index(s, insn) == next_kept(s, i + 1)) {
+        remove_instruction(s, i);
+    }
+}
+
+// optimizes the code of the byte file in place, leaves invalid bytecode to the checks of pre-decoding
+void optimize_bytecode(byte_file *bf) {
+    const char *code_end = bf->code_ptr + bf->bytecode_size;
+    peephole_state s = {.length = 0, .changed = true};
+    for (const char *ip = bf->code_ptr; ip < code_end; ++s.length) {
+        ip = analyze_bytecode(stdout, bf, ip, &empty_printer);
+    }
+    s.code = malloc((s.length + 1) * sizeof(peephole_instruction));
+    s.index_of = malloc((bf->bytecode_size + 1) * sizeof(u_int32_t));
+    if (s.code == NULL || s.index_of == NULL) {
+        failure("Severity ERROR: Can't allocate memory.\n");
+    }
+    for (u_int32_t offset = 0; offset <= bf->bytecode_size; ++offset) {
+        s.index_of[offset] = NOT_AN_INSTRUCTION;
+    }
+    bool *leaders = find_basic_block_leaders(bf);
+    u_int32_t i = 0;
+    for (const char *ip = bf->code_ptr; ip < code_end; ++i) {
+        const char *next_ip = analyze_bytecode(stdout, bf, ip, &empty_printer);
+        peephole_instruction *insn = &s.code[i];
+        insn->offset = ip - bf->code_ptr;
+        insn->size = next_ip - ip;
+        insn->bytecode = *ip;
+        insn->operand = insn->size >= 1 + sizeof(int32_t) ? *(int32_t *) (ip + 1) : 0;
+        insn->leader = leaders[insn->offset];
+        insn->removed = false;
+        s.index_of[insn->offset] = i;
+        ip = next_ip;
+    }
+    s.index_of[bf->bytecode_size] = s.length;
+    free(leaders);
+    for (i = 0; i < s.length; ++i) {
+        if (has_code_target(s.code[i].bytecode)
+            && ((u_int32_t) s.code[i].operand > bf->bytecode_size
+                || s.index_of[s.code[i].operand] == NOT_AN_INSTRUCTION)) {
+            free(s.code);
+            free(s.index_of);
+            return;
+        }
+    }
+
+    while (s.changed) {
+        s.changed = false;
+        for (i = next_kept(&s, 0); i < s.length; i = next_kept(&s, i + 1)) {
+            peephole_sequences(&s, i);
+            if (!s.code[i].removed && (s.code[i].bytecode == JMP || s.code[i].bytecode == CJMP_Z
+                                       || s.code[i].bytecode == CJMP_NZ)) {
+                peephole_jump(&s, i);
+            }
+        }
+    }
+
+    // new offsets by instruction index, removed instructions get the offset of the next kept one
+    u_int32_t *new_offset = malloc((s.length + 1) * sizeof(u_int32_t));
+    if (new_offset == NULL) {
+        failure("Severity ERROR: Can't allocate memory.\n");
+    }
+    u_int32_t size = 0;
+    for (i = 0; i < s.length; ++i) {
+        new_offset[i] = size;
+        size += s.code[i].removed ? 0 : s.code[i].size;
+    }
+    new_offset[s.length] = size;
+    char *code = malloc(size + 1);
+    if (code == NULL) {
+        failure("Severity ERROR: Can't allocate memory.\n");
+    }
+    for (i = 0; i < s.length; ++i) {
+        const peephole_instruction *insn = &s.code[i];
+        if (insn->removed) {
+            continue;
+        }
+        char *ip = code + new_offset[i];
+        memcpy(ip, bf->code_ptr + insn->offset, insn->size);
+        *ip = (char) insn->bytecode;
+        if (insn->bytecode == CONST) {
+            memcpy(ip + 1, &insn->operand, sizeof(int32_t));
+        } else if (has_code_target(insn->bytecode)) {
+            u_int32_t target = new_offset[s.index_of[insn->operand]];
+            memcpy(ip + 1, &target, sizeof(u_int32_t));
+        }
+    }
+    for (u_int32_t k = 0; k < bf->public_symbols_number; ++k) {
+        u_int32_t *entry = &bf->public_ptr[2 * k + 1];
+        if (*entry <= bf->bytecode_size && s.index_of[*entry] != NOT_AN_INSTRUCTION) {
+            *entry = new_offset[s.index_of[*entry]];
+        }
+    }
+    bf->code_ptr = code;
+    bf->bytecode_size = size;
+    free(new_offset);
+    free(s.code);
+    free(s.index_of);
+}
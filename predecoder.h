@@ -0,0 +1,439 @@
+#pragma once
+
+#include "bytecode_decoder.h"
+#include "byte_file.h"
+
+extern int LtagHash(char *s);
+
+// internal opcodes: bytecodes with meaningful lower bits are split into one opcode per lower bits value,
+// so that handlers never have to decode them at run time
+#define FOR_EACH_OPCODE(X) \
+    X(BINOP_PLUS)          \
+    X(BINOP_MINUS)         \
+    X(BINOP_MULTIPLY)      \
+    X(BINOP_DIVIDE)        \
+    X(BINOP_REMAINDER)     \
+    X(BINOP_LESS)          \
+    X(BINOP_LESS_EQUAL)    \
+    X(BINOP_GREATER)       \
+    X(BINOP_GREATER_EQUAL) \
+    X(BINOP_EQUAL)         \
+    X(BINOP_NOT_EQUAL)     \
+    X(BINOP_AND)           \
+    X(BINOP_OR)            \
+    X(LD_GLOBAL)           \
+    X(LD_LOCAL)            \
+    X(LD_ARGUMENT)         \
+    X(LD_CLOJURE)          \
+    X(LDA_GLOBAL)          \
+    X(LDA_LOCAL)           \
+    X(LDA_ARGUMENT)        \
+    X(LDA_CLOJURE)         \
+    X(ST_GLOBAL)           \
+    X(ST_LOCAL)            \
+    X(ST_ARGUMENT)         \
+    X(ST_CLOJURE)          \
+    X(PATT_STR)            \
+    X(PATT_TAG_STR)        \
+    X(PATT_TAG_ARR)        \
+    X(PATT_TAG_SEXP)       \
+    X(PATT_BOXED)          \
+    X(PATT_UNBOXED)        \
+    X(PATT_TAG_CLOSURE)    \
+    X(CONST)               \
+    X(STRING)              \
+    X(SEXP)                \
+    X(STA)                 \
+    X(JMP)                 \
+    X(CJMP_Z)              \
+    X(CJMP_NZ)             \
+    X(ELEM)                \
+    X(BEGIN)               \
+    X(CALL)                \
+    X(CALLC)               \
+    X(CALL_READ)           \
+    X(CALL_WRITE)          \
+    X(CALL_STRING)         \
+    X(CALL_LENGTH)         \
+    X(CALL_ARRAY)          \
+    X(END)                 \
+    X(DROP)                \
+    X(DUP)                 \
+    X(TAG)                 \
+    X(ARRAY)               \
+    X(FAIL)                \
+    X(LINE)                \
+    X(CLOSURE)             \
+    X(SWAP)                \
+    X(STI)                 \
+    X(RET)                 \
+    X(STOP)                \
+    /** BEGIN of a function compiled to native code by jit.h */ \
+    X(BEGIN_NATIVE)        \
+    /** CALL and CALLC followed by END, they reuse the frame of the caller, see predecode() */ \
+    X(TAIL_CALL)           \
+    X(TAIL_CALLC)          \
+    /** counting BEGIN and backward jumps of tiered execution, arg2 of the jumps is the function, see tiering.h */ \
+    X(BEGIN_COUNTED)       \
+    X(JMP_BACK)            \
+    X(CJMP_Z_BACK)         \
+    X(CJMP_NZ_BACK)        \
+    /** superinstructions, selected by select_superinstructions() */ \
+    X(DUP_CONST_ELEM)      \
+    X(CONST_ELEM)          \
+    X(ST_LOCAL_DROP)       \
+    X(DROP_DROP)           \
+    X(DUP_DUP)             \
+    X(LD_LOCAL_LD_LOCAL)   \
+    X(LD_LOCAL_LD_ARGUMENT) \
+    X(LD_ARGUMENT_LD_LOCAL) \
+    X(LD_ARGUMENT_LD_ARGUMENT) \
+    /** comparison fused with the conditional jump after it, arg1 = jump target */ \
+    X(LESS_CJMP_Z)         \
+    X(LESS_CJMP_NZ)        \
+    X(LESS_EQUAL_CJMP_Z)   \
+    X(LESS_EQUAL_CJMP_NZ)  \
+    X(GREATER_CJMP_Z)      \
+    X(GREATER_CJMP_NZ)     \
+    X(GREATER_EQUAL_CJMP_Z) \
+    X(GREATER_EQUAL_CJMP_NZ) \
+    X(EQUAL_CJMP_Z)        \
+    X(EQUAL_CJMP_NZ)       \
+    X(NOT_EQUAL_CJMP_Z)    \
+    X(NOT_EQUAL_CJMP_NZ)
+
+typedef enum {
+#define OPCODE_ENUM(NAME) OP_##NAME,
+    FOR_EACH_OPCODE(OPCODE_ENUM)
+#undef OPCODE_ENUM
+    OP_COUNT
+} opcode;
+
+static const char *const opcode_names[] = {
+#define OPCODE_NAME(NAME) #NAME,
+        FOR_EACH_OPCODE(OPCODE_NAME)
+#undef OPCODE_NAME
+};
+
+/**
+ * Pre-decoded instruction.
+ * Operands are parsed and aligned, jump and call targets are indices in the instruction array:
+ *   CONST          arg1 = boxed constant
+ *   STRING         arg1 = string pointer
+ *   SEXP, TAG      arg1 = tag hash (boxed, see LtagHash()), arg2 = arity
+ *   LD, LDA, ST    arg1 = index of the location, arguments are counted from the last one (see predecode())
+ *   JMP, CJMP      arg1 = target
+ *   BEGIN          arg1 = index of the function in decoded_program.functions, arg2 = number of locals
+ *   CALL           arg1 = target, arg2 = number of arguments
+ *   CALLC          arg1 = number of arguments, arg2 = index of the call site in decoded_program.call_sites
+ *   TAIL_CALL, TAIL_CALLC  operands of CALL and CALLC
+ *   CLOSURE        arg1 = target, arg2 = offset of the capture list in decoded_program.captures
+ *   ARRAY, CALL_ARRAY, LINE  arg1 = operand
+ *   FAIL           arg1, arg2 = operands
+ * A superinstruction replaces the first instruction of its sequence and keeps the operands of the fused ones,
+ * e.g. DUP_CONST_ELEM arg1 = boxed constant, LD_LOCAL_LD_ARGUMENT arg1, arg2 = indices of the two locations,
+ * LESS_CJMP_Z arg1 = jump target.
+ * The remaining instructions of the sequence stay in place, so instruction indices and jumps into the
+ * middle of a fused sequence are not affected.
+ */
+typedef struct {
+    const void *handler; // label of the threaded interpreter, bound by bind_threaded_handlers()
+    u_int32_t opcode;
+    auint arg1; // a word, as it holds boxed constants and string pointers
+    u_int32_t arg2;
+} instruction;
+
+typedef struct {
+    u_int32_t entry; // index of BEGIN
+    u_int32_t n_args;
+    u_int32_t n_locals;
+    // words of the virtual stack a frame of the function may use, computed by verify_program()
+    u_int32_t frame_size;
+    // compiled code of the function, NULL while it is interpreted (see jit.h)
+    void *native;
+    // tiered execution (see tiering.h): invocations and back edges, the count of the next promotion and the tier
+    u_int32_t hotness;
+    u_int32_t next_tier;
+    u_int32_t tier;
+} function_info;
+
+// monomorphic inline cache of a CALLC: the entry of the closure called last, its BEGIN holds the counts of
+// arguments and locals, and a closure with the same entry was already checked to take this number of arguments
+typedef struct {
+    const instruction *entry;
+} call_site;
+
+typedef struct {
+    byte_file *byteFile;
+    instruction *code;
+    u_int32_t length;
+    function_info *functions;
+    u_int32_t functions_number;
+    call_site *call_sites;
+    u_int32_t call_sites_number;
+    // set by verify_program(), the interpreter may then skip per-operation stack checks
+    bool verified;
+    // CLOSURE capture lists: number of captured values followed by (location, index) pairs
+    u_int32_t *captures;
+    u_int32_t captures_size;
+} decoded_program;
+
+static const u_int32_t NOT_AN_INSTRUCTION = (u_int32_t) -1;
+
+static inline u_int32_t read_int(const char **ip) {
+    *ip += sizeof(int);
+    return *(u_int32_t *) (*ip - sizeof(int));
+}
+
+// decodes one instruction starting at ip, returns the address of the next one
+static const char *decode_instruction(byte_file *bf, const char *ip, instruction *insn, u_int32_t *captures,
+                                      u_int32_t *captures_size) {
+    u_int8_t bytecode = *ip++;
+    insn->handler = NULL;
+    insn->arg1 = 0;
+    insn->arg2 = 0;
+    switch (high_bits(bytecode)) {
+        case BINOP_HIGH_BITS:
+            if (low_bits(bytecode) < PLUS || low_bits(bytecode) > OR) {
+                failure("Severity ERROR: Unknown binop bytecode.\n");
+            }
+            insn->opcode = OP_BINOP_PLUS + low_bits(bytecode) - PLUS;
+            return ip;
+        case LD_HIGH_BITS:
+        case LDA_HIGH_BITS:
+        case ST_HIGH_BITS: {
+            static const opcode base[] = {OP_LD_GLOBAL, OP_LDA_GLOBAL, OP_ST_GLOBAL};
+            if (low_bits(bytecode) > CLOJURE) {
+                failure("Severity ERROR: Invalid bytecode for loc.\n");
+            }
+            insn->opcode = base[high_bits(bytecode) - LD_HIGH_BITS] + low_bits(bytecode);
+            insn->arg1 = read_int(&ip);
+            return ip;
+        }
+        case PATT_HIGH_BITS:
+            if (low_bits(bytecode) > PATT_TAG_CLOSURE) {
+                failure("Severity RUNTIME: Unknown pattern type.\n");
+            }
+            insn->opcode = OP_PATT_STR + low_bits(bytecode);
+            return ip;
+        case 0xF:
+            insn->opcode = OP_STOP;
+            return ip;
+    }
+
+    switch (get_bytecode_type(bytecode)) {
+        case CONST:
+            insn->opcode = OP_CONST;
+            insn->arg1 = BOX((int32_t) read_int(&ip));
+            break;
+        case XSTRING:
+            insn->opcode = OP_STRING;
+            insn->arg1 = (auint) (bf->string_ptr + read_int(&ip));
+            break;
+        case SEXP:
+        case TAG:
+            // the string offset of the tag name, hashed by predecode()
+            insn->opcode = bytecode == SEXP ? OP_SEXP : OP_TAG;
+            insn->arg1 = read_int(&ip);
+            insn->arg2 = read_int(&ip);
+            break;
+        case JMP:
+        case CJMP_Z:
+        case CJMP_NZ:
+            insn->opcode = bytecode == JMP ? OP_JMP : bytecode == CJMP_Z ? OP_CJMP_Z : OP_CJMP_NZ;
+            insn->arg1 = read_int(&ip);
+            break;
+        case BEGIN:
+            insn->opcode = OP_BEGIN;
+            insn->arg1 = read_int(&ip);
+            insn->arg2 = read_int(&ip);
+            break;
+        case CALL:
+            insn->opcode = OP_CALL;
+            insn->arg1 = read_int(&ip);
+            insn->arg2 = read_int(&ip);
+            break;
+        case CALLC:
+            insn->opcode = OP_CALLC;
+            insn->arg1 = read_int(&ip);
+            break;
+        case CLOSURE: {
+            insn->opcode = OP_CLOSURE;
+            insn->arg1 = read_int(&ip);
+            insn->arg2 = *captures_size;
+            u_int32_t n = read_int(&ip);
+            if (captures != NULL) {
+                captures[*captures_size] = n;
+            }
+            for (u_int32_t i = 0; i < n; ++i) {
+                u_int8_t loc = *ip++;
+                u_int32_t index = read_int(&ip);
+                if (loc > CLOJURE) {
+                    failure("Severity ERROR: Invalid code for loc.\n");
+                }
+                if (captures != NULL) {
+                    captures[*captures_size + 2 * i + 1] = loc;
+                    captures[*captures_size + 2 * i + 2] = index;
+                }
+            }
+            *captures_size += 2 * n + 1;
+            break;
+        }
+        case ARRAY:
+        case CALL_ARRAY:
+        case LINE:
+            insn->opcode = bytecode == ARRAY ? OP_ARRAY : bytecode == CALL_ARRAY ? OP_CALL_ARRAY : OP_LINE;
+            insn->arg1 = read_int(&ip);
+            break;
+        case FAIL:
+            insn->opcode = OP_FAIL;
+            insn->arg1 = read_int(&ip);
+            insn->arg2 = read_int(&ip);
+            break;
+#define DECODE_SIMPLE(BC_NAME) \
+        case BC_NAME:          \
+            insn->opcode = OP_##BC_NAME; \
+            break;
+        DECODE_SIMPLE(STA)
+        DECODE_SIMPLE(END)
+        DECODE_SIMPLE(DROP)
+        DECODE_SIMPLE(DUP)
+        DECODE_SIMPLE(SWAP)
+        DECODE_SIMPLE(ELEM)
+        DECODE_SIMPLE(CALL_READ)
+        DECODE_SIMPLE(CALL_WRITE)
+        DECODE_SIMPLE(CALL_STRING)
+        DECODE_SIMPLE(CALL_LENGTH)
+        DECODE_SIMPLE(STI)
+        DECODE_SIMPLE(RET)
+#undef DECODE_SIMPLE
+        default:
+            failure("Severity ERROR: Unknown bytecode type.\n");
+    }
+    return ip;
+}
+
+static u_int32_t resolve_target(const u_int32_t *offset_to_index, u_int32_t bytecode_size, u_int32_t offset) {
+    if (offset >= bytecode_size || offset_to_index[offset] == NOT_AN_INSTRUCTION) {
+        failure("Severity ERROR: Invalid jump target 0x%.8x.\n", offset);
+    }
+    return offset_to_index[offset];
+}
+
+// hashes the tag name once at load time instead of on every SEXP and TAG
+static u_int32_t tag_hash(byte_file *bf, u_int32_t offset) {
+    if (offset >= bf->string_table_size) {
+        failure("Severity ERROR: Tag name 0x%.8x out of the string table.\n", offset);
+    }
+    return LtagHash(bf->string_ptr + offset);
+}
+
+// calls don't reverse their arguments, so the first argument is the deepest one on the stack:
+// argument i of a function with n arguments is at stack_fp + 3 + (n - 1 - i), after the saved frame pointer,
+// the number of arguments and the return address
+static u_int32_t argument_slot(u_int32_t n_args, u_int32_t index) {
+    return n_args - 1 - index;
+}
+
+// pre-decoding pass: turns the bytecode of byte_file into an aligned instruction array
+decoded_program *predecode(byte_file *bf) {
+    const char *code_end = bf->code_ptr + bf->bytecode_size;
+    u_int32_t *offset_to_index = malloc(bf->bytecode_size * sizeof(u_int32_t));
+    decoded_program *program = malloc(sizeof(decoded_program));
+    if (offset_to_index == NULL || program == NULL) {
+        failure("Severity ERROR: Can't allocate memory.\n");
+    }
+    for (u_int32_t i = 0; i < bf->bytecode_size; ++i) {
+        offset_to_index[i] = NOT_AN_INSTRUCTION;
+    }
+
+    // first pass: find instruction boundaries and the size of capture lists
+    instruction insn;
+    program->length = 0;
+    program->captures_size = 0;
+    program->functions_number = 0;
+    program->call_sites_number = 0;
+    for (const char *ip = bf->code_ptr; ip < code_end;) {
+        offset_to_index[ip - bf->code_ptr] = program->length++;
+        ip = decode_instruction(bf, ip, &insn, NULL, &program->captures_size);
+        if (insn.opcode == OP_BEGIN) {
+            program->functions_number++;
+        } else if (insn.opcode == OP_CALLC) {
+            program->call_sites_number++;
+        }
+    }
+
+    program->byteFile = bf;
+    program->code = malloc(program->length * sizeof(instruction));
+    program->captures = malloc((program->captures_size + 1) * sizeof(u_int32_t));
+    program->functions = malloc((program->functions_number + 1) * sizeof(function_info));
+    program->call_sites = calloc(program->call_sites_number + 1, sizeof(call_site));
+    program->verified = false;
+    if (program->code == NULL || program->captures == NULL || program->functions == NULL
+        || program->call_sites == NULL) {
+        failure("Severity ERROR: Can't allocate memory.\n");
+    }
+
+    // second pass: decode operands and resolve control flow targets to instruction indices
+    u_int32_t captures_size = 0;
+    u_int32_t functions_number = 0;
+    u_int32_t call_sites_number = 0;
+    u_int32_t n_args = 0;
+    instruction *current = program->code;
+    for (const char *ip = bf->code_ptr; ip < code_end; ++current) {
+        ip = decode_instruction(bf, ip, current, program->captures, &captures_size);
+        switch (current->opcode) {
+            case OP_JMP:
+            case OP_CJMP_Z:
+            case OP_CJMP_NZ:
+            case OP_CALL:
+                current->arg1 = resolve_target(offset_to_index, bf->bytecode_size, current->arg1);
+                break;
+            case OP_CLOSURE: {
+                current->arg1 = resolve_target(offset_to_index, bf->bytecode_size, current->arg1);
+                u_int32_t *capture = program->captures + current->arg2;
+                for (u_int32_t i = 0; i < capture[0]; ++i) {
+                    if (capture[2 * i + 1] == ARGUMENT) {
+                        capture[2 * i + 2] = argument_slot(n_args, capture[2 * i + 2]);
+                    }
+                }
+                break;
+            }
+            case OP_LD_ARGUMENT:
+            case OP_LDA_ARGUMENT:
+            case OP_ST_ARGUMENT:
+                current->arg1 = argument_slot(n_args, current->arg1);
+                break;
+            case OP_SEXP:
+            case OP_TAG:
+                current->arg1 = tag_hash(bf, current->arg1);
+                break;
+            case OP_BEGIN: {
+                function_info *function = &program->functions[functions_number];
+                function->entry = current - program->code;
+                function->n_args = current->arg1;
+                function->n_locals = current->arg2;
+                n_args = function->n_args;
+                function->frame_size = 0;
+                function->native = NULL;
+                function->hotness = 0;
+                function->next_tier = 0;
+                function->tier = 0;
+                current->arg1 = functions_number++;
+                break;
+            }
+            case OP_CALLC:
+                current->arg2 = call_sites_number++;
+                break;
+        }
+    }
+    // a call right before END is a tail call, END stays in place for jumps to it
+    for (u_int32_t i = 0; i + 1 < program->length; ++i) {
+        instruction *insn = &program->code[i];
+        if (program->code[i + 1].opcode == OP_END && (insn->opcode == OP_CALL || insn->opcode == OP_CALLC)) {
+            insn->opcode = insn->opcode == OP_CALL ? OP_TAIL_CALL : OP_TAIL_CALLC;
+        }
+    }
+    free(offset_to_index);
+    return program;
+}
@@ -0,0 +1,113 @@
+			.data
+__gc_stack_bottom:	.quad	0
+__gc_stack_top:	        .quad	0
+
+			.globl	__pre_gc
+			.globl	__post_gc
+			.globl	__gc_init
+			.globl	__gc_root_scan_stack
+			.globl	__gc_stack_top
+			.globl	__gc_stack_bottom
+			.extern	__init
+			.extern	gc_test_and_copy_root
+			.text
+
+	// x86-64 version of gc_runtime.s: the same roots and checks
+	// with 8-byte words, calls keep %rsp aligned to 16 bytes
+__gc_init:		movq	%rbp, __gc_stack_bottom(%rip)
+			addq	$8, __gc_stack_bottom(%rip)
+			subq	$8, %rsp
+			call	__init
+			addq	$8, %rsp
+			ret
+
+	// if __gc_stack_top is equal to 0
+	// then set __gc_stack_top to %rbp
+	// else return
+__pre_gc:
+			pushq	%rax
+			movq	__gc_stack_top(%rip), %rax
+			cmpq	$0, %rax
+			jne	__pre_gc_2
+			movq	%rbp, %rax
+			movq	%rax, __gc_stack_top(%rip)
+__pre_gc_2:
+			popq	%rax
+			ret
+
+	// if __gc_stack_top has been set by the caller
+	//   (i.e. it is equal to its %rbp)
+	// then set __gc_stack_top to 0
+	// else return
+__post_gc:
+			pushq	%rax
+			movq	__gc_stack_top(%rip), %rax
+			cmpq	%rax, %rbp
+			jnz	__post_gc2
+			movq	$0, __gc_stack_top(%rip)
+__post_gc2:
+			popq	%rax
+			ret
+
+	// Scan stack for roots
+	// strting from __gc_stack_top
+	// till __gc_stack_bottom
+__gc_root_scan_stack:
+			pushq	%rbp
+			movq	%rsp, %rbp
+			pushq	%rbx
+			pushq	%r12
+			movq	__gc_stack_top(%rip), %rbx
+			jmp 	next
+
+loop:
+			movq	(%rbx), %r12
+
+	// check that it is not a pointer to code section
+	// i.e. the following is not true:
+	// __executable_start <= (%rbx) <= __etext
+check11:
+			leaq	__executable_start(%rip), %rdx
+			cmpq	%r12, %rdx
+			jna	check12
+			jmp	check21
+
+check12:
+			leaq	__etext(%rip), %rdx
+			cmpq	%r12, %rdx
+			jnb	next
+
+	// check that it is not a pointer into the program stack
+	// i.e. the following is not true:
+	// __gc_stack_bottom <= (%rbx) <= __gc_stack_top
+check21:
+			cmpq	%r12, __gc_stack_top(%rip)
+			jna	check22
+			jmp	loop2
+
+check22:
+			cmpq	%r12, __gc_stack_bottom(%rip)
+			jnb	next
+
+	// check if it a valid pointer
+	// i.e. the lastest bit is set to zero
+loop2:
+			testq	$0x00000001, %r12
+			jnz     next
+gc_run_t:
+			movq	%rbx, %rdi
+			call	gc_test_and_copy_root
+
+next:
+			addq	$8, %rbx
+			cmpq	%rbx, __gc_stack_bottom(%rip)
+			jne	loop
+returnn:
+			movq	$0, %rax
+			popq	%r12
+			popq	%rbx
+			movq	%rbp, %rsp
+			popq	%rbp
+			ret
+
+			.section .note.GNU-stack,"",@progbits
@@ -3,6 +3,8 @@
 # define _GNU_SOURCE 1
 
 # include "runtime.h"
+# include <signal.h>
+# include <unistd.h>
 
 # define __ENABLE_GC__
 # ifndef __ENABLE_GC__
@@ -31,9 +33,33 @@ typedef struct {
 
 static pool from_space;
 static pool to_space;
+static pool nursery;
 size_t      *current;
 /* end */
 
+/* GC statistics, printed at exit and after SIGUSR1 when enabled with gc_set_stats */
+# define GC_PAUSE_BUCKETS 7
+typedef struct {
+    size_t   collections;               // full collections and incremental cycles
+    size_t   minor_collections;
+    size_t   condemned;                 // words in use when collections started
+    size_t   copied;                    // words copied to the to-space or promoted to the old space
+    size_t   peak_to_space;             // words
+    size_t   space_extensions;          // times the spaces have grown
+    size_t   pauses[GC_PAUSE_BUCKETS];  // pauses under 10us, 100us, ..., 1s, and longer ones
+    uint64_t pause_total;               // ns
+    uint64_t pause_max;                 // ns
+} gc_statistics;
+
+static gc_statistics         gc_stats;
+static int                   gc_stats_format    = 0;
+// set by SIGUSR1, the statistics are printed by the next alloc, outside collections
+static volatile sig_atomic_t gc_stats_requested = 0;
+size_t                       gc_allocated[4];
+
+// the space new objects are bump-allocated in, set by __init for the GC mode
+gc_alloc_region gc_inline_alloc = {&from_space.current, &from_space.end, SIZE_MAX};
+
 # ifdef __ENABLE_GC__
 
 /* GC extern invariant for built-in functions */
@@ -57,18 +83,18 @@ void __post_gc_subst () {}
 # define CLOSURE_TAG 0x00000007
 # define UNBOXED_TAG 0x00000009 // Not actually a tag; used to return from LkindOf
 
-# define LEN(x) ((x & 0xFFFFFFF8) >> 3)
-# define TAG(x)  (x & 0x00000007)
+# define LEN(x) ((aint) (((auint) (x) & ~(auint) 7) >> 3))
+# define TAG(x)  ((x) & 0x00000007)
 
-# define TO_DATA(x) ((data*)((char*)(x)-sizeof(int)))
-# define TO_SEXP(x) ((sexp*)((char*)(x)-2*sizeof(int)))
+# define TO_DATA(x) ((data*)((char*)(x)-sizeof(aint)))
+# define TO_SEXP(x) ((sexp*)((char*)(x)-2*sizeof(aint)))
 # ifdef DEBUG_PRINT // GET_SEXP_TAG is necessary for printing from space
 # define GET_SEXP_TAG(x) (LEN(x))
 #endif
 
-# define UNBOXED(x)  (((int) (x)) &  0x0001)
-# define UNBOX(x)    (((int) (x)) >> 1)
-# define BOX(x)      ((((int) (x)) << 1) | 0x0001)
+# define UNBOXED(x)  (((aint) (x)) &  0x0001)
+# define UNBOX(x)    (((aint) (x)) >> 1)
+# define BOX(x)      ((aint) (((auint) (x)) << 1) | 0x0001)
 
 /* GC extra roots */
 # define MAX_EXTRA_ROOTS_NUMBER 32
@@ -126,7 +152,7 @@ void pop_extra_root (void ** p) {
 
 /* end */
 
-static void vfailure (char *s, va_list args) {
+static void __attribute__ ((noreturn)) vfailure (char *s, va_list args) {
     fflush   (stdout);
     fprintf  (stderr, "*** FAILURE: ");
     vfprintf (stderr, s, args); // vprintf (char *, va_list) <-> printf (char *, ...)
@@ -157,31 +183,40 @@ void Lassert (void *f, char *s, ...) {
   do if (!UNBOXED(x) && TAG(TO_DATA(x)->tag) \
 	 != STRING_TAG) failure ("string value expected in %s\n", memo); while (0)
 
+// the header word of an object: its kind in the lower 3 bits and its length above them, or the forward
+// pointer to its copy while the GC runs
 typedef struct {
-    int tag;
+    auint tag;
     char contents[0];
 } data;
 
 typedef struct {
-    int tag;
+    auint tag;
     data contents;
 } sexp;
 
 extern void* alloc    (size_t);
-extern void* Bsexp    (int n, ...);
-extern int   LtagHash (char*);
+extern void* Bsexp    (aint n, ...);
+
+// alloc of an object with the given tag, counted in the statistics
+static inline void * alloc_object (aint tag, size_t size) {
+    gc_allocated[tag >> 1] += size;
+    return alloc (size);
+}
+
+extern aint  LtagHash (char*);
 
 void *global_sysargs;
 
 // Gets a raw tag
-extern int LkindOf (void *p) {
+extern aint LkindOf (void *p) {
     if (UNBOXED(p)) return UNBOXED_TAG;
 
     return TAG(TO_DATA(p)->tag);
 }
 
 // Compare sexprs tags
-extern int LcompareTags (void *p, void *q) {
+extern aint LcompareTags (void *p, void *q) {
     data *pd, *qd;
 
     ASSERT_BOXED ("compareTags, 0", p);
@@ -198,7 +233,7 @@ extern int LcompareTags (void *p, void *q) {
         BOX((GET_SEXP_TAG(TO_SEXP(p)->tag)) - (GET_SEXP_TAG(TO_SEXP(p)->tag)));
 #endif
     }
-    else failure ("not a sexpr in compareTags: %d, %d\n", TAG(pd->tag), TAG(qd->tag));
+    else failure ("not a sexpr in compareTags: %d, %d\n", (int) TAG(pd->tag), (int) TAG(qd->tag));
 
     return 0; // never happens
 }
@@ -221,7 +256,7 @@ void* Ls__Infix_58 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "!!";
-int Ls__Infix_3333 (void *p, void *q) {
+aint Ls__Infix_3333 (void *p, void *q) {
     ASSERT_UNBOXED("captured !!:1", p);
     ASSERT_UNBOXED("captured !!:2", q);
 
@@ -229,7 +264,7 @@ int Ls__Infix_3333 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "&&";
-int Ls__Infix_3838 (void *p, void *q) {
+aint Ls__Infix_3838 (void *p, void *q) {
     ASSERT_UNBOXED("captured &&:1", p);
     ASSERT_UNBOXED("captured &&:2", q);
 
@@ -237,12 +272,12 @@ int Ls__Infix_3838 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "==";
-int Ls__Infix_6161 (void *p, void *q) {
+aint Ls__Infix_6161 (void *p, void *q) {
     return BOX(p == q);
 }
 
 // Functional synonym for built-in operator "!=";
-int Ls__Infix_3361 (void *p, void *q) {
+aint Ls__Infix_3361 (void *p, void *q) {
     ASSERT_UNBOXED("captured !=:1", p);
     ASSERT_UNBOXED("captured !=:2", q);
 
@@ -250,7 +285,7 @@ int Ls__Infix_3361 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "<=";
-int Ls__Infix_6061 (void *p, void *q) {
+aint Ls__Infix_6061 (void *p, void *q) {
     ASSERT_UNBOXED("captured <=:1", p);
     ASSERT_UNBOXED("captured <=:2", q);
 
@@ -258,7 +293,7 @@ int Ls__Infix_6061 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "<";
-int Ls__Infix_60 (void *p, void *q) {
+aint Ls__Infix_60 (void *p, void *q) {
     ASSERT_UNBOXED("captured <:1", p);
     ASSERT_UNBOXED("captured <:2", q);
 
@@ -266,7 +301,7 @@ int Ls__Infix_60 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator ">=";
-int Ls__Infix_6261 (void *p, void *q) {
+aint Ls__Infix_6261 (void *p, void *q) {
     ASSERT_UNBOXED("captured >=:1", p);
     ASSERT_UNBOXED("captured >=:2", q);
 
@@ -274,7 +309,7 @@ int Ls__Infix_6261 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator ">";
-int Ls__Infix_62 (void *p, void *q) {
+aint Ls__Infix_62 (void *p, void *q) {
     ASSERT_UNBOXED("captured >:1", p);
     ASSERT_UNBOXED("captured >:2", q);
 
@@ -282,7 +317,7 @@ int Ls__Infix_62 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "+";
-int Ls__Infix_43 (void *p, void *q) {
+aint Ls__Infix_43 (void *p, void *q) {
     ASSERT_UNBOXED("captured +:1", p);
     ASSERT_UNBOXED("captured +:2", q);
 
@@ -290,18 +325,18 @@ int Ls__Infix_43 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "-";
-int Ls__Infix_45 (void *p, void *q) {
+aint Ls__Infix_45 (void *p, void *q) {
     if (UNBOXED(p)) {
         ASSERT_UNBOXED("captured -:2", q);
         return BOX(UNBOX(p) - UNBOX(q));
     }
 
     ASSERT_BOXED("captured -:1", q);
-    return BOX(p - q);
+    return BOX((char *) p - (char *) q);
 }
 
 // Functional synonym for built-in operator "*";
-int Ls__Infix_42 (void *p, void *q) {
+aint Ls__Infix_42 (void *p, void *q) {
     ASSERT_UNBOXED("captured *:1", p);
     ASSERT_UNBOXED("captured *:2", q);
 
@@ -309,7 +344,7 @@ int Ls__Infix_42 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "/";
-int Ls__Infix_47 (void *p, void *q) {
+aint Ls__Infix_47 (void *p, void *q) {
     ASSERT_UNBOXED("captured /:1", p);
     ASSERT_UNBOXED("captured /:2", q);
 
@@ -317,14 +352,14 @@ int Ls__Infix_47 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "%";
-int Ls__Infix_37 (void *p, void *q) {
+aint Ls__Infix_37 (void *p, void *q) {
     ASSERT_UNBOXED("captured %:1", p);
     ASSERT_UNBOXED("captured %:2", q);
 
     return BOX(UNBOX(p) % UNBOX(q));
 }
 
-extern int Llength (void *p) {
+extern aint Llength (void *p) {
     data *a = (data*) BOX (NULL);
 
     ASSERT_BOXED(".length", p);
@@ -337,7 +372,7 @@ static char* chars = "_abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234
 
 extern char* de_hash (int);
 
-extern int LtagHash (char *s) {
+extern aint LtagHash (char *s) {
     char *p;
     int  h = 0, limit = 0;
 
@@ -454,11 +489,11 @@ int is_valid_heap_pointer (void *p);
 
 static void printValue (void *p) {
     data *a = (data*) BOX(NULL);
-    int i   = BOX(0);
-    if (UNBOXED(p)) printStringBuf ("%d", UNBOX(p));
+    aint i  = BOX(0);
+    if (UNBOXED(p)) printStringBuf ("%ld", (long) UNBOX(p));
     else {
         if (! is_valid_heap_pointer(p)) {
-            printStringBuf ("0x%x", p);
+            printStringBuf ("%p", p);
             return;
         }
 
@@ -472,8 +507,8 @@ static void printValue (void *p) {
             case CLOSURE_TAG:
                 printStringBuf ("<closure ");
                 for (i = 0; i < LEN(a->tag); i++) {
-                    if (i) printValue ((void*)((int*) a->contents)[i]);
-                    else printStringBuf ("0x%x", (void*)((int*) a->contents)[i]);
+                    if (i) printValue ((void*)((aint*) a->contents)[i]);
+                    else printStringBuf ("%p", (void*)((aint*) a->contents)[i]);
 
                     if (i != LEN(a->tag) - 1) printStringBuf (", ");
                 }
@@ -483,7 +518,7 @@ static void printValue (void *p) {
             case ARRAY_TAG:
                 printStringBuf ("[");
                 for (i = 0; i < LEN(a->tag); i++) {
-                    printValue ((void*)((int*) a->contents)[i]);
+                    printValue ((void*)((aint*) a->contents)[i]);
                     if (i != LEN(a->tag) - 1) printStringBuf (", ");
                 }
                 printStringBuf ("]");
@@ -502,8 +537,8 @@ static void printValue (void *p) {
                     printStringBuf ("{");
 
                     while (LEN(a->tag)) {
-                        printValue ((void*)((int*) b->contents)[0]);
-                        b = (data*)((int*) b->contents)[1];
+                        printValue ((void*)((aint*) b->contents)[0]);
+                        b = (data*)((aint*) b->contents)[1];
                         if (! UNBOXED(b)) {
                             printStringBuf (", ");
                             b = TO_DATA(b);
@@ -518,7 +553,7 @@ static void printValue (void *p) {
                     if (LEN(a->tag)) {
                         printStringBuf (" (");
                         for (i = 0; i < LEN(a->tag); i++) {
-                            printValue ((void*)((int*) a->contents)[i]);
+                            printValue ((void*)((aint*) a->contents)[i]);
                             if (i != LEN(a->tag) - 1) printStringBuf (", ");
                         }
                         printStringBuf (")");
@@ -528,7 +563,7 @@ static void printValue (void *p) {
                 break;
 
             default:
-                printStringBuf ("*** invalid tag: 0x%x ***", TAG(a->tag));
+                printStringBuf ("*** invalid tag: 0x%x ***", (int) TAG(a->tag));
         }
     }
 }
@@ -556,8 +591,8 @@ static void stringcat (void *p) {
                     data *b = a;
 
                     while (LEN(a->tag)) {
-                        stringcat ((void*)((int*) b->contents)[0]);
-                        b = (data*)((int*) b->contents)[1];
+                        stringcat ((void*)((aint*) b->contents)[0]);
+                        b = (data*)((aint*) b->contents)[1];
                         if (! UNBOXED(b)) {
                             b = TO_DATA(b);
                         }
@@ -569,24 +604,24 @@ static void stringcat (void *p) {
                 break;
 
             default:
-                printStringBuf ("*** invalid tag: 0x%x ***", TAG(a->tag));
+                printStringBuf ("*** invalid tag: 0x%x ***", (int) TAG(a->tag));
         }
     }
 }
 
-extern int Luppercase (void *v) {
+extern aint Luppercase (void *v) {
     ASSERT_UNBOXED("Luppercase:1", v);
     return BOX(toupper ((int) UNBOX(v)));
 }
 
-extern int Llowercase (void *v) {
+extern aint Llowercase (void *v) {
     ASSERT_UNBOXED("Llowercase:1", v);
     return BOX(tolower ((int) UNBOX(v)));
 }
 
-extern int LmatchSubString (char *subj, char *patt, int pos) {
+extern aint LmatchSubString (char *subj, char *patt, aint pos) {
     data *p = TO_DATA(patt), *s = TO_DATA(subj);
-    int   n;
+    aint  n;
 
     ASSERT_STRING("matchSubString:1", subj);
     ASSERT_STRING("matchSubString:2", patt);
@@ -600,9 +635,9 @@ extern int LmatchSubString (char *subj, char *patt, int pos) {
     return BOX(strncmp (subj + UNBOX(pos), patt, n) == 0);
 }
 
-extern void* Lsubstring (void *subj, int p, int l) {
+extern void* Lsubstring (void *subj, aint p, aint l) {
     data *d = TO_DATA(subj);
-    int pp = UNBOX (p), ll = UNBOX (l);
+    aint pp = UNBOX (p), ll = UNBOX (l);
 
     ASSERT_STRING("substring:1", subj);
     ASSERT_UNBOXED("substring:2", p);
@@ -614,7 +649,7 @@ extern void* Lsubstring (void *subj, int p, int l) {
         __pre_gc ();
 
         push_extra_root (&subj);
-        r = (data*) alloc (ll + 1 + sizeof (int));
+        r = (data*) alloc_object (STRING_TAG, ll + 1 + sizeof (aint));
         pop_extra_root (&subj);
 
         r->tag = STRING_TAG | (ll << 3);
@@ -626,8 +661,8 @@ extern void* Lsubstring (void *subj, int p, int l) {
         return r->contents;
     }
 
-    failure ("substring: index out of bounds (position=%d, length=%d, \
-            subject length=%d)", pp, ll, LEN(d->tag));
+    failure ("substring: index out of bounds (position=%ld, length=%ld, \
+            subject length=%ld)", (long) pp, (long) ll, (long) LEN(d->tag));
 }
 
 extern struct re_pattern_buffer *Lregexp (char *regexp) {
@@ -637,16 +672,16 @@ extern struct re_pattern_buffer *Lregexp (char *regexp) {
 
     memset (b, 0, sizeof (regex_t));
 
-    int n = (int) re_compile_pattern (regexp, strlen (regexp), b);
+    const char *error = re_compile_pattern (regexp, strlen (regexp), b);
 
-    if (n != 0) {
-        failure ("%", strerror (n));
+    if (error != NULL) {
+        failure ("%s\n", error);
     };
 
     return b;
 }
 
-extern int LregexpMatch (struct re_pattern_buffer *b, char *s, int pos) {
+extern aint LregexpMatch (struct re_pattern_buffer *b, char *s, aint pos) {
     int res;
 
     ASSERT_BOXED("regexpMatch:1", b);
@@ -665,23 +700,23 @@ extern int LregexpMatch (struct re_pattern_buffer *b, char *s, int pos) {
 }
 
 extern void* Bstring (void*);
+static void gc_finish_cycle (void);
 
 void *Lclone (void *p) {
     data *obj;
     sexp *sobj;
     void* res;
-    int n;
 #ifdef DEBUG_PRINT
-    register int * ebp asm ("ebp");
   indent++; print_indent ();
   printf ("Lclone arg: %p %p\n", &p, p); fflush (stdout);
 #endif
+    gc_finish_cycle ();
     __pre_gc ();
 
     if (UNBOXED(p)) return p;
     else {
         data *a = TO_DATA(p);
-        int t   = TAG(a->tag), l = LEN(a->tag);
+        aint t  = TAG(a->tag), l = LEN(a->tag);
 
         push_extra_root (&p);
         switch (t) {
@@ -703,8 +738,10 @@ void *Lclone (void *p) {
                 print_indent ();
       printf ("Lclone: closure or array &p=%p p=%p ebp=%p\n", &p, p, ebp); fflush (stdout);
 #endif
-                obj = (data*) alloc (sizeof(int) * (l+1));
-                memcpy (obj, TO_DATA(p), sizeof(int) * (l+1));
+                obj = (data*) alloc_object (t, sizeof(aint) * (l+1));
+                // the allocation may start a collection, the fields of p are to-space ones once it is over
+                gc_finish_cycle ();
+                memcpy (obj, TO_DATA(p), sizeof(aint) * (l+1));
                 res = (void*) (obj->contents);
                 break;
 
@@ -712,13 +749,14 @@ void *Lclone (void *p) {
 #ifdef DEBUG_PRINT
                 print_indent (); printf ("Lclone: sexp\n"); fflush (stdout);
 #endif
-                sobj = (sexp*) alloc (sizeof(int) * (l+2));
-                memcpy (sobj, TO_SEXP(p), sizeof(int) * (l+2));
+                sobj = (sexp*) alloc_object (SEXP_TAG, sizeof(aint) * (l+2));
+                gc_finish_cycle ();
+                memcpy (sobj, TO_SEXP(p), sizeof(aint) * (l+2));
                 res = (void*) sobj->contents.contents;
                 break;
 
             default:
-                failure ("invalid tag %d in clone *****\n", t);
+                failure ("invalid tag %d in clone *****\n", (int) t);
         }
         pop_extra_root (&p);
     }
@@ -744,7 +782,7 @@ int inner_hash (int depth, unsigned acc, void *p) {
     if (UNBOXED(p)) return HASH_APPEND(acc, UNBOX(p));
     else if (is_valid_heap_pointer (p)) {
         data *a = TO_DATA(p);
-        int t = TAG(a->tag), l = LEN(a->tag), i;
+        aint t = TAG(a->tag), l = LEN(a->tag), i;
 
         acc = HASH_APPEND(acc, t);
         acc = HASH_APPEND(acc, l);
@@ -762,7 +800,7 @@ int inner_hash (int depth, unsigned acc, void *p) {
             }
 
             case CLOSURE_TAG:
-                acc = HASH_APPEND(acc, ((void**) a->contents)[0]);
+                acc = HASH_APPEND(acc, (auint) ((void**) a->contents)[0]);
                 i = 1;
                 break;
 
@@ -772,9 +810,9 @@ int inner_hash (int depth, unsigned acc, void *p) {
 
             case SEXP_TAG: {
 #ifndef DEBUG_PRINT
-                int ta = TO_SEXP(p)->tag;
+                aint ta = TO_SEXP(p)->tag;
 #else
-                int ta = GET_SEXP_TAG(TO_SEXP(p)->tag);
+                aint ta = GET_SEXP_TAG(TO_SEXP(p)->tag);
 #endif
                 acc = HASH_APPEND(acc, ta);
                 i = 0;
@@ -782,7 +820,7 @@ int inner_hash (int depth, unsigned acc, void *p) {
             }
 
             default:
-                failure ("invalid tag %d in hash *****\n", t);
+                failure ("invalid tag %d in hash *****\n", (int) t);
         }
 
         for (; i<l; i++)
@@ -790,20 +828,21 @@ int inner_hash (int depth, unsigned acc, void *p) {
 
         return acc;
     }
-    else return HASH_APPEND(acc, p);
+    else return HASH_APPEND(acc, (auint) p);
 }
 
 extern void* LstringInt (char *b) {
-    int n;
-    sscanf (b, "%d", &n);
+    long n;
+    sscanf (b, "%ld", &n);
     return (void*) BOX(n);
 }
 
-extern int Lhash (void *p) {
+extern aint Lhash (void *p) {
+    gc_finish_cycle ();
     return BOX(0x3fffff & inner_hash (0, 0, p));
 }
 
-extern int LflatCompare (void *p, void *q) {
+extern aint LflatCompare (void *p, void *q) {
     if (UNBOXED(p)) {
         if (UNBOXED(q)) {
             return BOX (UNBOX(p) - UNBOX(q));
@@ -812,16 +851,18 @@ extern int LflatCompare (void *p, void *q) {
         return -1;
     }
     else if (~UNBOXED(q)) {
-        return BOX(p - q);
+        return BOX((char *) p - (char *) q);
     }
     else BOX(1);
 }
 
-extern int Lcompare (void *p, void *q) {
-# define COMPARE_AND_RETURN(x,y) do if (x != y) return BOX(x - y); while (0)
+extern aint Lcompare (void *p, void *q) {
+# define COMPARE_AND_RETURN(x,y) do if (x != y) return BOX((aint) (x) - (aint) (y)); while (0)
 
     if (p == q) return BOX(0);
 
+    gc_finish_cycle ();
+
     if (UNBOXED(p)) {
         if (UNBOXED(q)) return BOX(UNBOX(p) - UNBOX(q));
         else return BOX(-1);
@@ -831,9 +872,9 @@ extern int Lcompare (void *p, void *q) {
         if (is_valid_heap_pointer (p)) {
             if (is_valid_heap_pointer (q)) {
                 data *a = TO_DATA(p), *b = TO_DATA(q);
-                int ta = TAG(a->tag), tb = TAG(b->tag);
-                int la = LEN(a->tag), lb = LEN(b->tag);
-                int i;
+                aint ta = TAG(a->tag), tb = TAG(b->tag);
+                aint la = LEN(a->tag), lb = LEN(b->tag);
+                aint i;
 
                 COMPARE_AND_RETURN (ta, tb);
 
@@ -854,9 +895,9 @@ extern int Lcompare (void *p, void *q) {
 
                     case SEXP_TAG: {
 #ifndef DEBUG_PRINT
-                        int ta = TO_SEXP(p)->tag, tb = TO_SEXP(q)->tag;
+                        aint ta = TO_SEXP(p)->tag, tb = TO_SEXP(q)->tag;
 #else
-                        int ta = GET_SEXP_TAG(TO_SEXP(p)->tag), tb = GET_SEXP_TAG(TO_SEXP(q)->tag);
+                        aint ta = GET_SEXP_TAG(TO_SEXP(p)->tag), tb = GET_SEXP_TAG(TO_SEXP(q)->tag);
 #endif
                         COMPARE_AND_RETURN (ta, tb);
                         COMPARE_AND_RETURN (la, lb);
@@ -865,11 +906,11 @@ extern int Lcompare (void *p, void *q) {
                     }
 
                     default:
-                        failure ("invalid tag %d in compare *****\n", ta);
+                        failure ("invalid tag %d in compare *****\n", (int) ta);
                 }
 
                 for (; i<la; i++) {
-                    int c = Lcompare (((void**) a->contents)[i], ((void**) b->contents)[i]);
+                    aint c = Lcompare (((void**) a->contents)[i], ((void**) b->contents)[i]);
                     if (c != BOX(0)) return BOX(c);
                 }
 
@@ -878,11 +919,11 @@ extern int Lcompare (void *p, void *q) {
             else return BOX(-1);
         }
         else if (is_valid_heap_pointer (q)) return BOX(1);
-        else return BOX (p - q);
+        else return BOX ((char *) p - (char *) q);
     }
 }
 
-extern void* Belem (void *p, int i) {
+extern void* Belem (void *p, aint i) {
     data *a = (data *)BOX(NULL);
 
     ASSERT_BOXED(".elem:1", p);
@@ -895,10 +936,10 @@ extern void* Belem (void *p, int i) {
         return (void*) BOX(a->contents[i]);
     }
 
-    return (void*) ((int*) a->contents)[i];
+    return GC_READ_BARRIER((void*) ((aint*) a->contents)[i]);
 }
 
-extern void* Belem_link (void *p, int i) {
+extern void* Belem_link (void *p, aint i) {
     data *a = (data *)BOX(NULL);
 
     ASSERT_BOXED(".elem:1", p);
@@ -913,23 +954,23 @@ extern void* Belem_link (void *p, int i) {
         return a->contents + i;
     }
 
-    return ((int*) a->contents) + i;
+    return ((aint*) a->contents) + i;
 }
 
-extern void* LmakeArray (int length) {
+extern void* LmakeArray (aint length) {
     data *r;
-    int n, *p;
+    aint n, *p;
 
     ASSERT_UNBOXED("makeArray:1", length);
 
     __pre_gc ();
 
     n = UNBOX(length);
-    r = (data*) alloc (sizeof(int) * (n+1));
+    r = (data*) alloc_object (ARRAY_TAG, sizeof(aint) * (n+1));
 
     r->tag = ARRAY_TAG | (n << 3);
 
-    p = (int*) r->contents;
+    p = (aint*) r->contents;
     while (n--) *p++ = BOX(0);
 
     __post_gc ();
@@ -937,15 +978,15 @@ extern void* LmakeArray (int length) {
     return r->contents;
 }
 
-extern void* LmakeString (int length) {
-    int   n = UNBOX(length);
+extern void* LmakeString (aint length) {
+    aint  n = UNBOX(length);
     data *r;
 
     ASSERT_UNBOXED("makeString", length);
 
     __pre_gc () ;
 
-    r = (data*) alloc (n + 1 + sizeof (int));
+    r = (data*) alloc_object (STRING_TAG, n + 1 + sizeof (aint));
 
     r->tag = STRING_TAG | (n << 3);
 
@@ -955,7 +996,7 @@ extern void* LmakeString (int length) {
 }
 
 extern void* Bstring (void *p) {
-    int   n = strlen (p);
+    aint  n = strlen (p);
     data *s = NULL;
 
     __pre_gc ();
@@ -987,6 +1028,7 @@ extern void* Lstringcat (void *p) {
 
     /* ASSERT_BOXED("stringcat", p); */
 
+    gc_finish_cycle ();
     __pre_gc ();
 
     createStringBuf ();
@@ -1006,6 +1048,7 @@ extern void* Lstringcat (void *p) {
 extern void* Lstring (void *p) {
     void *s = (void *) BOX (NULL);
 
+    gc_finish_cycle ();
     __pre_gc () ;
 
     createStringBuf ();
@@ -1022,43 +1065,41 @@ extern void* Lstring (void *p) {
     return s;
 }
 
-extern void* Bclosure (int bn, void *entry, ...) {
+extern void* Bclosure (aint bn, void *entry, ...) {
     va_list args;
-    int     i, ai;
-    register int * ebp asm ("ebp");
-    size_t  *argss;
+    aint    i;
     data    *r;
-    int     n = UNBOX(bn);
+    aint    n = UNBOX(bn);
+    // the captured values are collected and rooted here since varargs have no portable address
+    void    *values[n];
 
     __pre_gc ();
 #ifdef DEBUG_PRINT
     indent++; print_indent ();
   printf ("Bclosure: create n = %d\n", n); fflush(stdout);
 #endif
-    argss = (ebp + 12);
-    for (i = 0; i<n; i++, argss++) {
-        push_extra_root ((void**)argss);
+    va_start(args, entry);
+
+    for (i = 0; i<n; i++) {
+        values[i] = va_arg(args, void*);
+        push_extra_root (&values[i]);
     }
 
-    r = (data*) alloc (sizeof(int) * (n+2));
+    va_end(args);
+
+    r = (data*) alloc_object (CLOSURE_TAG, sizeof(aint) * (n+2));
 
     r->tag = CLOSURE_TAG | ((n + 1) << 3);
     ((void**) r->contents)[0] = entry;
 
-    va_start(args, entry);
-
     for (i = 0; i<n; i++) {
-        ai = va_arg(args, int);
-        ((int*)r->contents)[i+1] = ai;
+        ((void**)r->contents)[i+1] = values[i];
     }
 
-    va_end(args);
-
     __post_gc();
 
-    argss--;
-    for (i = 0; i<n; i++, argss--) {
-        pop_extra_root ((void**)argss);
+    for (i = n; i-- > 0;) {
+        pop_extra_root (&values[i]);
     }
 
 #ifdef DEBUG_PRINT
@@ -1070,40 +1111,28 @@ extern void* Bclosure (int bn, void *entry, ...) {
     return r->contents;
 }
 
-extern void* Bclosure_my (int bn, void *entry, int *values) {
-    int     i, ai;
-    register int * ebp asm ("ebp");
-    size_t  *argss;
+// values points to the captured values on the virtual stack, the first one on top; the GC updates them there
+extern void* Bclosure_my (aint bn, void *entry, aint *values) {
+    aint    i;
     data    *r;
-    int     n = UNBOX(bn);
+    aint    n = UNBOX(bn);
 
     __pre_gc ();
 #ifdef DEBUG_PRINT
     indent++; print_indent ();
   printf ("Bclosure: create n = %d\n", n); fflush(stdout);
 #endif
-    argss = (ebp + 12);
-    for (i = 0; i<n; i++, argss++) {
-        push_extra_root ((void**)argss);
-    }
-
-    r = (data*) alloc (sizeof(int) * (n+2));
+    r = (data*) alloc_object (CLOSURE_TAG, sizeof(aint) * (n+2));
 
     r->tag = CLOSURE_TAG | ((n + 1) << 3);
     ((void**) r->contents)[0] = entry;
 
     for (i = 0; i<n; i++) {
-        ai = values[i];
-        ((int*)r->contents)[i+1] = ai;
+        ((aint*)r->contents)[i+1] = values[i];
     }
 
     __post_gc();
 
-    argss--;
-    for (i = 0; i<n; i++, argss--) {
-        pop_extra_root ((void**)argss);
-    }
-
 #ifdef DEBUG_PRINT
     print_indent ();
   printf ("Bclosure: ends\n", n); fflush(stdout);
@@ -1113,11 +1142,11 @@ extern void* Bclosure_my (int bn, void *entry, int *values) {
     return r->contents;
 }
 
-extern void* Barray (int bn, ...) {
+extern void* Barray (aint bn, ...) {
     va_list args;
-    int     i, ai;
+    aint    i, ai;
     data    *r;
-    int     n = UNBOX(bn);
+    aint    n = UNBOX(bn);
 
     __pre_gc ();
 
@@ -1125,15 +1154,15 @@ extern void* Barray (int bn, ...) {
     indent++; print_indent ();
   printf ("Barray: create n = %d\n", n); fflush(stdout);
 #endif
-    r = (data*) alloc (sizeof(int) * (n+1));
+    r = (data*) alloc_object (ARRAY_TAG, sizeof(aint) * (n+1));
 
     r->tag = ARRAY_TAG | (n << 3);
 
     va_start(args, bn);
 
     for (i = 0; i<n; i++) {
-        ai = va_arg(args, int);
-        ((int*)r->contents)[i] = ai;
+        ai = va_arg(args, aint);
+        ((aint*)r->contents)[i] = ai;
     }
 
     va_end(args);
@@ -1145,10 +1174,11 @@ extern void* Barray (int bn, ...) {
     return r->contents;
 }
 
-extern void* Barray_my (int bn, int *data_) {
-    int     i, ai;
+// data_ points to the elements on the virtual stack as they were pushed, the last one first
+extern void* Barray_my (aint bn, aint *data_) {
+    aint    i, ai;
     data    *r;
-    int     n = UNBOX(bn);
+    aint    n = UNBOX(bn);
 
     __pre_gc ();
 
@@ -1156,13 +1186,13 @@ extern void* Barray_my (int bn, int *data_) {
     indent++; print_indent ();
   printf ("Barray: create n = %d\n", n); fflush(stdout);
 #endif
-    r = (data*) alloc (sizeof(int) * (n+1));
+    r = (data*) alloc_object (ARRAY_TAG, sizeof(aint) * (n+1));
 
     r->tag = ARRAY_TAG | (n << 3);
 
     for (i = 0; i<n; i++) {
-        ai = *(data_++);
-        ((int*)r->contents)[i] = ai;
+        ai = data_[n - 1 - i];
+        ((aint*)r->contents)[i] = ai;
     }
 
     __post_gc();
@@ -1172,22 +1202,21 @@ extern void* Barray_my (int bn, int *data_) {
     return r->contents;
 }
 
-extern void* Bsexp (int bn, ...) {
+extern void* Bsexp (aint bn, ...) {
     va_list args;
-    int     i;
-    int     ai;
-    size_t *p;
+    aint    i;
+    aint    ai;
     sexp   *r;
     data   *d;
-    int n = UNBOX(bn);
+    aint n = UNBOX(bn);
 
     __pre_gc () ;
 
 #ifdef DEBUG_PRINT
     indent++; print_indent ();
-  printf("Bsexp: allocate %zu!\n",sizeof(int) * (n+1)); fflush (stdout);
+  printf("Bsexp: allocate %zu!\n",sizeof(aint) * (n+1)); fflush (stdout);
 #endif
-    r = (sexp*) alloc (sizeof(int) * (n+1));
+    r = (sexp*) alloc_object (SEXP_TAG, sizeof(aint) * (n+1));
     d = &(r->contents);
     r->tag = 0;
 
@@ -1196,13 +1225,12 @@ extern void* Bsexp (int bn, ...) {
     va_start(args, bn);
 
     for (i=0; i<n-1; i++) {
-        ai = va_arg(args, int);
+        ai = va_arg(args, aint);
 
-        p = (size_t*) ai;
-        ((int*)d->contents)[i] = ai;
+        ((aint*)d->contents)[i] = ai;
     }
 
-    r->tag = UNBOX(va_arg(args, int));
+    r->tag = UNBOX(va_arg(args, aint));
 
 #ifdef DEBUG_PRINT
     r->tag = SEXP_TAG | ((r->tag) << 3);
@@ -1218,29 +1246,28 @@ extern void* Bsexp (int bn, ...) {
     return d->contents;
 }
 
-extern void* Bsexp_my (int bn, int tag, int *data_) {
-    int     i;
-    int     ai;
-    size_t *p;
+// data_ points to the elements on the virtual stack as they were pushed, the last one first
+extern void* Bsexp_my (aint bn, aint tag, aint *data_) {
+    aint    i;
+    aint    ai;
     sexp   *r;
     data   *d;
-    int n = UNBOX(bn);
+    aint n = UNBOX(bn);
 
 #ifdef DEBUG_PRINT
     indent++; print_indent ();
-  printf("Bsexp: allocate %zu!\n",sizeof(int) * (n+1)); fflush (stdout);
+  printf("Bsexp: allocate %zu!\n",sizeof(aint) * (n+1)); fflush (stdout);
 #endif
-    r = (sexp*) alloc (sizeof(int) * (n+1));
+    r = (sexp*) alloc_object (SEXP_TAG, sizeof(aint) * (n+1));
     d = &(r->contents);
     r->tag = 0;
 
     d->tag = SEXP_TAG | ((n-1) << 3);
 
     for (i=0; i<n-1; i++) {
-        ai = *(data_++);
+        ai = data_[n - 2 - i];
 
-        p = (size_t*) ai;
-        ((int*)d->contents)[i] = ai;
+        ((aint*)d->contents)[i] = ai;
     }
 
     r->tag = UNBOX(tag);
@@ -1255,7 +1282,7 @@ extern void* Bsexp_my (int bn, int tag, int *data_) {
     return d->contents;
 }
 
-extern int Btag (void *d, int t, int n) {
+extern aint Btag (void *d, aint t, aint n) {
     data *r;
 
     if (UNBOXED(d)) return BOX(0);
@@ -1271,7 +1298,7 @@ extern int Btag (void *d, int t, int n) {
     }
 }
 
-extern int Barray_patt (void *d, int n) {
+extern aint Barray_patt (void *d, aint n) {
     data *r;
 
     if (UNBOXED(d)) return BOX(0);
@@ -1281,7 +1308,7 @@ extern int Barray_patt (void *d, int n) {
     }
 }
 
-extern int Bstring_patt (void *x, void *y) {
+extern aint Bstring_patt (void *x, void *y) {
     data *rx = (data *) BOX (NULL),
             *ry = (data *) BOX (NULL);
 
@@ -1297,45 +1324,48 @@ extern int Bstring_patt (void *x, void *y) {
     }
 }
 
-extern int Bclosure_tag_patt (void *x) {
+extern aint Bclosure_tag_patt (void *x) {
     if (UNBOXED(x)) return BOX(0);
 
     return BOX(TAG(TO_DATA(x)->tag) == CLOSURE_TAG);
 }
 
-extern int Bboxed_patt (void *x) {
+extern aint Bboxed_patt (void *x) {
     return BOX(UNBOXED(x) ? 0 : 1);
 }
 
-extern int Bunboxed_patt (void *x) {
+extern aint Bunboxed_patt (void *x) {
     return BOX(UNBOXED(x) ? 1 : 0);
 }
 
-extern int Barray_tag_patt (void *x) {
+extern aint Barray_tag_patt (void *x) {
     if (UNBOXED(x)) return BOX(0);
 
     return BOX(TAG(TO_DATA(x)->tag) == ARRAY_TAG);
 }
 
-extern int Bstring_tag_patt (void *x) {
+extern aint Bstring_tag_patt (void *x) {
     if (UNBOXED(x)) return BOX(0);
 
     return BOX(TAG(TO_DATA(x)->tag) == STRING_TAG);
 }
 
-extern int Bsexp_tag_patt (void *x) {
+extern aint Bsexp_tag_patt (void *x) {
     if (UNBOXED(x)) return BOX(0);
 
     return BOX(TAG(TO_DATA(x)->tag) == SEXP_TAG);
 }
 
-extern void* Bsta (void *v, int i, void *x) {
+extern void* Bsta (void *v, aint i, void *x) {
     if (UNBOXED(i)) {
         ASSERT_BOXED(".sta:3", x);
         //    ASSERT_UNBOXED(".sta:2", i);
 
         if (TAG(TO_DATA(x)->tag) == STRING_TAG)((char*) x)[UNBOX(i)] = (char) UNBOX(v);
-        else ((int*) x)[UNBOX(i)] = (int) v;
+        else {
+            ((aint*) x)[UNBOX(i)] = (aint) v;
+            gc_write_barrier (&((void**) x)[UNBOX(i)], v);
+        }
 
         return v;
     }
@@ -1343,11 +1373,15 @@ extern void* Bsta (void *v, int i, void *x) {
     // fflush(stderr);
 
     * (void**) i = v;
+    gc_write_barrier ((void**) i, v);
 
     return v;
 }
 
+// unboxes the integer arguments in place, which relies on the i386 va_list being a pointer to the
+// arguments on the stack; elsewhere the arguments are passed to the formatting functions as they are
 static void fix_unboxed (char *s, va_list va) {
+#if defined(__i386__)
     size_t *p = (size_t*)va;
     int i = 0;
 
@@ -1361,6 +1395,7 @@ static void fix_unboxed (char *s, va_list va) {
         }
         s++;
     }
+#endif
 }
 
 extern void Lfailure (char *s, ...) {
@@ -1371,11 +1406,11 @@ extern void Lfailure (char *s, ...) {
     vfailure    (s, args);
 }
 
-extern void Bmatch_failure (void *v, char *fname, int line, int col) {
+extern void Bmatch_failure (void *v, char *fname, aint line, aint col) {
     createStringBuf ();
     printValue (v);
     failure ("match failure at %s:%d:%d, value '%s'\n",
-             fname, UNBOX(line), UNBOX(col), stringBuf.contents);
+             fname, (int) UNBOX(line), (int) UNBOX(col), stringBuf.contents);
 }
 
 extern void* /*Lstrcat*/ Li__Infix_4343 (void *a, void *b) {
@@ -1393,7 +1428,7 @@ extern void* /*Lstrcat*/ Li__Infix_4343 (void *a, void *b) {
 
     push_extra_root (&a);
     push_extra_root (&b);
-    d  = (data *) alloc (sizeof(int) + LEN(da->tag) + LEN(db->tag) + 1);
+    d  = (data *) alloc_object (STRING_TAG, sizeof(aint) + LEN(da->tag) + LEN(db->tag) + 1);
     pop_extra_root (&b);
     pop_extra_root (&a);
 
@@ -1454,12 +1489,12 @@ extern void* LgetEnv (char *var) {
     return s;
 }
 
-extern int Lsystem (char *cmd) {
+extern aint Lsystem (char *cmd) {
     return BOX (system (cmd));
 }
 
 extern void Lfprintf (FILE *f, char *s, ...) {
-    va_list args = (va_list) BOX (NULL);
+    va_list args;
 
     ASSERT_BOXED("fprintf:1", f);
     ASSERT_STRING("fprintf:2", s);
@@ -1473,7 +1508,7 @@ extern void Lfprintf (FILE *f, char *s, ...) {
 }
 
 extern void Lprintf (char *s, ...) {
-    va_list args = (va_list) BOX (NULL);
+    va_list args;
 
     ASSERT_STRING("printf:1", s);
 
@@ -1597,35 +1632,35 @@ extern void* Ltl (void *v) {
 }
 
 /* Lread is an implementation of the "read" construct */
-extern int Lread () {
-    int result = BOX(0);
+extern aint Lread () {
+    long result = BOX(0);
 
     printf ("> ");
     fflush (stdout);
-    scanf  ("%d", &result);
+    scanf  ("%ld", &result);
 
     return BOX(result);
 }
 
 /* Lwrite is an implementation of the "write" construct */
-extern int Lwrite (int n) {
-    printf ("%d\n", UNBOX(n));
+extern aint Lwrite (aint n) {
+    printf ("%ld\n", (long) UNBOX(n));
     fflush (stdout);
 
     return 0;
 }
 
-extern int Lrandom (int n) {
+extern aint Lrandom (aint n) {
     ASSERT_UNBOXED("Lrandom, 0", n);
 
     if (UNBOX(n) <= 0) {
-        failure ("invalid range in random: %d\n", UNBOX(n));
+        failure ("invalid range in random: %ld\n", (long) UNBOX(n));
     }
 
     return BOX (random () % UNBOX(n));
 }
 
-extern int Ltime () {
+extern aint Ltime () {
     struct timespec t;
 
     clock_gettime (CLOCK_MONOTONIC_RAW, &t);
@@ -1635,8 +1670,8 @@ extern int Ltime () {
 
 extern void set_args (int argc, char *argv[]) {
     data *a;
-    int n = argc, *p = NULL;
-    int i;
+    aint n = argc, *p = NULL;
+    aint i;
 
     __pre_gc ();
 
@@ -1656,7 +1691,8 @@ extern void set_args (int argc, char *argv[]) {
         print_indent ();
     printf ("set_args: iteration %i %p %p ->\n", i, &p, p); fflush(stdout);
 #endif
-        ((int*)p) [i] = (int) Bstring (argv[i]);
+        ((aint*)p) [i] = (aint) Bstring (argv[i]);
+        gc_write_barrier (&((void**)p) [i], (void*) ((aint*)p) [i]);
 #ifdef DEBUG_PRINT
         print_indent ();
     printf ("set_args: iteration %i <- %p %p\n", i, &p, p); fflush(stdout);
@@ -1701,31 +1737,232 @@ void __gc_init_subst () {}
 # endif
 
 extern void __gc_root_scan_stack ();
+extern void gc_test_and_copy_root (size_t ** root);
+
+// precise scanner of the stack roots set by the program, the stack is scanned conservatively without it
+static void (*root_scanner) (gc_root_visitor visit) = NULL;
+
+extern void gc_set_root_scanner (void (*scanner) (gc_root_visitor visit)) {
+    root_scanner = scanner;
+}
+
+static void gc_root_scan_program_stack (void) {
+    if (root_scanner) root_scanner (gc_test_and_copy_root);
+    else __gc_root_scan_stack ();
+}
 
 /* ======================================== */
 /*           Mark-and-copy                  */
 /* ======================================== */
 
 //static size_t SPACE_SIZE = 16;
-static size_t SPACE_SIZE = 256 * 1024 * 1024;
+static size_t SPACE_SIZE = 256 * 1024;
 // static size_t SPACE_SIZE = 128;
 // static size_t SPACE_SIZE = 1024 * 1024;
 
+/* Heap sizing: the spaces start at SPACE_SIZE words and grow when more than half of the heap
+   survives a full collection, or when the survivors don't fit, and shrink back down to the
+   initial size while less than an eighth survives. Spaces are mapped with MAP_NORESERVE, so
+   only the pages used are committed, and never grow beyond the heap limit. */
+static size_t min_space_size = 0;
+static size_t max_space_size = SIZE_MAX / sizeof(size_t);
+
+extern void gc_set_heap_limit (size_t bytes) {
+    max_space_size = bytes / sizeof(size_t);
+}
+
+// the size a space grows to: twice as large, up to the heap limit
+static size_t grown_space_size (void) {
+    return SPACE_SIZE < max_space_size / 2 ? SPACE_SIZE << 1 : max_space_size;
+}
+
+// grows the spaces mapped from now on
+static void grow_space_size (void) {
+    size_t size = grown_space_size ();
+    if (size > SPACE_SIZE) gc_stats.space_extensions++;
+    SPACE_SIZE = size;
+}
+
+static void heap_limit_exceeded (void) {
+    failure ("heap limit of %zu bytes exceeded\n", max_space_size * sizeof(size_t));
+}
+
+/* Generational mode: objects are bump-allocated in a small nursery and the live ones
+   are promoted to the from-space, the old space, by minor collections. Old objects
+   referring to nursery ones are recorded in the remembered set by the write barrier. */
+static int    generational     = 0;
+static size_t NURSERY_SIZE     = 256 * 1024;
+// larger objects are allocated in the old space
+# define LARGE_OBJECT_SIZE (NURSERY_SIZE / 4)
+static int    minor_collection = 0;
+// the space objects are copied to: the to-space, or the old space in minor collections
+static pool  *copy_space       = &to_space;
+
+typedef struct {
+    void ***slots;
+    size_t  size;
+    size_t  capacity;
+} remembered_set;
+
+static remembered_set remembered;
+
+extern void gc_set_generational (void) {
+    generational = 1;
+}
+
+/* Parallel mode: full collections copy the heap on several threads. Each thread claims chunks
+   of the to-space with an atomic bump of current, takes the objects it copies with CAS on the
+   header word and keeps the copied objects whose fields are still to be copied (the grey set)
+   in its own deque, which the other threads steal from when they run out of work. */
+# define MAX_GC_THREADS 64
+// to-space chunks claimed by a copying thread at once, in words
+# define GC_CHUNK_SIZE  4096
+// larger copies get to-space of their own, so a chunk is left for a new one with less than this unused
+# define GC_LARGE_COPY  (GC_CHUNK_SIZE / 8)
+// to-space the copies of live words may take: the unused chunk ends, under a seventh of the copies,
+// and the last chunk of each thread
+# define GC_COPY_EXTENT(live, threads) ((live) + (live) / 7 + (threads) * GC_CHUNK_SIZE)
+static int gc_threads = 1;
+
+extern void gc_set_threads (int n) {
+    gc_threads = n < 1 ? 1 : n > MAX_GC_THREADS ? MAX_GC_THREADS : n;
+}
+
+/* Incremental mode (Baker's algorithm): a collection copies the roots to the to-space, then
+   the objects reachable from them in steps of at most gc_pause_budget words, one step each
+   time the mutator runs out of its allocation window. Meanwhile new objects are allocated
+   in windows at the top of the to-space, and the read barrier copies the from-space values
+   loaded from heap objects, so the mutator never sees a from-space pointer and its stores
+   need no barrier. */
+static int     incremental     = 0;
+int            gc_collecting   = 0;
+static size_t  gc_pause_budget = 16 * 1024;
+// objects allocated during the last collection are at the top of the space, from high_begin
+static size_t *high_begin      = NULL;
+
+extern void gc_set_incremental (void) {
+    incremental = 1;
+}
+
+extern void gc_set_pause_budget (size_t words) {
+    if (words > 0) gc_pause_budget = words;
+}
+
+/* ======================================== */
+/*              Statistics                  */
+/* ======================================== */
+
+extern void gc_set_stats (int format) {
+    gc_stats_format = format;
+}
+
+static uint64_t gc_clock (void) {
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// records a pause of the mutator started at the given time
+static void gc_pause (uint64_t start) {
+    uint64_t ns    = gc_clock () - start;
+    uint64_t bound = 10000;
+    int      i     = 0;
+    for (; i < GC_PAUSE_BUCKETS - 1 && ns >= bound; i++) bound *= 10;
+    gc_stats.pauses[i]++;
+    gc_stats.pause_total += ns;
+    if (ns > gc_stats.pause_max) gc_stats.pause_max = ns;
+}
+
+// prints the statistics to stderr
+static void gc_stats_report (void) {
+    static const char *bounds[GC_PAUSE_BUCKETS] = {"10us", "100us", "1ms", "10ms", "100ms", "1s", "inf"};
+    static char buf[2048];
+    size_t  *a         = gc_allocated;
+    size_t   allocated = a[0] + a[1] + a[2] + a[3];
+    size_t   pauses    = 0;
+    // survival rate in thousandths
+    size_t   survival  = gc_stats.condemned ? (size_t) ((uint64_t) gc_stats.copied * 1000 / gc_stats.condemned) : 0;
+    int      n         = 0;
+
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) pauses += gc_stats.pauses[i];
+    if (gc_stats_format == GC_STATS_JSON) {
+        n = snprintf (buf, sizeof (buf),
+                      "{\"collections\": %zu, \"minor_collections\": %zu, "
+                      "\"allocated\": {\"total\": %zu, \"string\": %zu, \"array\": %zu, \"sexp\": %zu, \"closure\": %zu}, "
+                      "\"copied\": %zu, \"survival_rate\": %zu.%03zu, "
+                      "\"peak_to_space\": %zu, \"space_extensions\": %zu, "
+                      "\"pauses\": {\"count\": %zu, \"total_us\": %llu, \"max_us\": %llu, \"histogram\": {",
+                      gc_stats.collections, gc_stats.minor_collections,
+                      allocated, a[0], a[1], a[2], a[3],
+                      gc_stats.copied * sizeof(size_t), survival / 1000, survival % 1000,
+                      gc_stats.peak_to_space * sizeof(size_t), gc_stats.space_extensions,
+                      pauses, (unsigned long long) (gc_stats.pause_total / 1000),
+                      (unsigned long long) (gc_stats.pause_max / 1000));
+        for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+            n += snprintf (buf + n, sizeof (buf) - n, "%s\"%s\": %zu", i ? ", " : "", bounds[i], gc_stats.pauses[i]);
+        }
+        n += snprintf (buf + n, sizeof (buf) - n, "}}}\n");
+    } else {
+        n = snprintf (buf, sizeof (buf),
+                      "GC statistics:\n"
+                      "  collections:      %zu full, %zu minor\n"
+                      "  allocated:        %zu bytes (strings %zu, arrays %zu, s-expressions %zu, closures %zu)\n"
+                      "  copied:           %zu bytes, survival rate %zu.%zu%%\n"
+                      "  peak to-space:    %zu bytes, extended %zu times\n"
+                      "  pauses:           %zu, total %llu us, max %llu us\n",
+                      gc_stats.collections, gc_stats.minor_collections,
+                      allocated, a[0], a[1], a[2], a[3],
+                      gc_stats.copied * sizeof(size_t), survival / 10, survival % 10,
+                      gc_stats.peak_to_space * sizeof(size_t), gc_stats.space_extensions,
+                      pauses, (unsigned long long) (gc_stats.pause_total / 1000),
+                      (unsigned long long) (gc_stats.pause_max / 1000));
+        for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+            n += snprintf (buf + n, sizeof (buf) - n, "    %2s %-6s %zu\n",
+                           i < GC_PAUSE_BUCKETS - 1 ? "<" : ">=", bounds[i < GC_PAUSE_BUCKETS - 1 ? i : i - 1],
+                           gc_stats.pauses[i]);
+        }
+    }
+    if (write (STDERR_FILENO, buf, n) < 0) return;
+}
+
+// snprintf isn't async-signal-safe and the counters may be half updated, so the handler only records the request
+static void gc_stats_signal (int sig) {
+    (void) sig;
+    gc_stats_requested = 1;
+}
+
+// reports the statistics at exit and on SIGUSR1 if gc_set_stats or the LAMA_GC_STATS variable
+// (text or json) has enabled them
+static void init_stats (void) {
+    struct sigaction action;
+    char            *format = getenv ("LAMA_GC_STATS");
+
+    if (gc_stats_format == 0 && format != NULL) {
+        gc_stats_format = strcmp (format, "json") == 0 ? GC_STATS_JSON : GC_STATS_TEXT;
+    }
+    if (gc_stats_format == 0) return;
+    atexit (gc_stats_report);
+    memset (&action, 0, sizeof (action));
+    action.sa_handler = gc_stats_signal;
+    action.sa_flags   = SA_RESTART;
+    sigaction (SIGUSR1, &action, NULL);
+}
+
 static int free_pool (pool * p) {
     size_t *a = p->begin, b = p->size;
     p->begin   = NULL;
     p->size    = 0;
     p->end     = NULL;
     p->current = NULL;
-    return munmap((void *)a, b);
+    return munmap((void *)a, b * sizeof(size_t));
 }
 
 static void init_to_space (int flag) {
     size_t space_size = 0;
-    if (flag) SPACE_SIZE = SPACE_SIZE << 1;
+    if (flag) grow_space_size ();
     space_size     = SPACE_SIZE * sizeof(size_t);
     to_space.begin = mmap (NULL, space_size, PROT_READ | PROT_WRITE,
-                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
     if (to_space.begin == MAP_FAILED) {
         perror ("EROOR: init_to_space: mmap failed\n");
         exit   (1);
@@ -1733,6 +1970,7 @@ static void init_to_space (int flag) {
     to_space.current = to_space.begin;
     to_space.end     = to_space.begin + SPACE_SIZE;
     to_space.size    = SPACE_SIZE;
+    if (SPACE_SIZE > gc_stats.peak_to_space) gc_stats.peak_to_space = SPACE_SIZE;
 }
 
 static void gc_swap_spaces (void) {
@@ -1754,23 +1992,40 @@ static void gc_swap_spaces (void) {
 #endif
 }
 
+# define IN_OLD_SPACE(p)			\
+  ((size_t)from_space.begin <= (size_t)p &&	\
+   (size_t)from_space.end   >  (size_t)p)
+
+# define IN_NURSERY(p)				\
+  ((size_t)nursery.begin <= (size_t)p &&	\
+   (size_t)nursery.end   >  (size_t)p)
+
 # define IS_VALID_HEAP_POINTER(p)\
   (!UNBOXED(p) &&		 \
-   (size_t)from_space.begin <= (size_t)p &&	 \
-   (size_t)from_space.end   >  (size_t)p)
+   (IN_OLD_SPACE(p) || IN_NURSERY(p)))
+
+// the objects a collection copies: minor collections leave the old space in place
+# define IS_CONDEMNED(p)	\
+  (!UNBOXED(p) &&		\
+   (IN_NURSERY(p) || (!minor_collection && IN_OLD_SPACE(p))))
 
 # define IN_PASSIVE_SPACE(p)	\
   ((size_t)to_space.begin <= (size_t)p	&&	\
    (size_t)to_space.end   >  (size_t)p)
 
+# define IN_COPY_SPACE(p)			\
+  ((size_t)copy_space->begin <= (size_t)p &&	\
+   (size_t)copy_space->end   >  (size_t)p)
+
 # define IS_FORWARD_PTR(p)			\
-  (!UNBOXED(p) && IN_PASSIVE_SPACE(p))
+  (!UNBOXED(p) && IN_COPY_SPACE(p))
 
 int is_valid_heap_pointer (void *p)  {
     return IS_VALID_HEAP_POINTER(p);
 }
 
 extern size_t * gc_copy (size_t *obj);
+extern void     gc_root_scan_data (void);
 
 static void copy_elements (size_t *where, size_t *from, int len) {
     int    i = 0;
@@ -1781,7 +2036,7 @@ static void copy_elements (size_t *where, size_t *from, int len) {
 #endif
     for (i = 0; i < len; i++) {
         size_t elem = from[i];
-        if (!IS_VALID_HEAP_POINTER(elem)) {
+        if (!IS_CONDEMNED(elem)) {
             *where = elem;
             where++;
 #ifdef DEBUG_PRINT
@@ -1816,8 +2071,10 @@ static void copy_elements (size_t *where, size_t *from, int len) {
 
 static int extend_spaces (void) {
     void *p = (void *) BOX (NULL);
-    size_t old_space_size = SPACE_SIZE        * sizeof(size_t),
-            new_space_size = (SPACE_SIZE << 1) * sizeof(size_t);
+    size_t new_size       = grown_space_size ();
+    size_t old_space_size = SPACE_SIZE * sizeof(size_t),
+            new_space_size = new_size   * sizeof(size_t);
+    if (new_size == SPACE_SIZE) return 1;
     p = mremap(to_space.begin, old_space_size, new_space_size, 0);
 #ifdef DEBUG_PRINT
     indent++; print_indent ();
@@ -1835,9 +2092,11 @@ static int extend_spaces (void) {
   fflush (stdout);
   indent--;
 #endif
-    to_space.end    += SPACE_SIZE;
-    SPACE_SIZE      =  SPACE_SIZE << 1;
+    to_space.end    =  to_space.begin + new_size;
+    SPACE_SIZE      =  new_size;
     to_space.size   =  SPACE_SIZE;
+    gc_stats.space_extensions++;
+    if (SPACE_SIZE > gc_stats.peak_to_space) gc_stats.peak_to_space = SPACE_SIZE;
     return 0;
 }
 
@@ -1855,7 +2114,7 @@ extern size_t * gc_copy (size_t *obj) {
   fflush (stdout);
 #endif
 
-    if (!IS_VALID_HEAP_POINTER(obj)) {
+    if (!IS_CONDEMNED(obj)) {
 #ifdef DEBUG_PRINT
         print_indent ();
     printf ("gc_copy: invalid ptr: %p\n", obj); fflush (stdout);
@@ -1864,11 +2123,11 @@ extern size_t * gc_copy (size_t *obj) {
         return obj;
     }
 
-    if (!IN_PASSIVE_SPACE(current) && current != to_space.end) {
+    if (!IN_COPY_SPACE(current) && current != copy_space->end) {
 #ifdef DEBUG_PRINT
         print_indent ();
     printf("ERROR: gc_copy: out-of-space %p %p %p\n",
-	   current, to_space.begin, to_space.end);
+	   current, copy_space->begin, copy_space->end);
     fflush(stdout);
 #endif
         perror("ERROR: gc_copy: out-of-space\n");
@@ -1901,7 +2160,7 @@ extern size_t * gc_copy (size_t *obj) {
             current += i+1;
             *copy = d->tag;
             copy++;
-            d->tag = (int) copy;
+            d->tag = (auint) copy;
             copy_elements (copy, obj, i);
             break;
 
@@ -1910,11 +2169,11 @@ extern size_t * gc_copy (size_t *obj) {
             print_indent ();
       printf ("gc_copy:array_tag; len =  %zu\n", LEN(d->tag)); fflush (stdout);
 #endif
-            current += ((LEN(d->tag) + 1) * sizeof (int) - 1) / sizeof (size_t) + 1;
+            current += ((LEN(d->tag) + 1) * sizeof (aint) - 1) / sizeof (size_t) + 1;
             *copy = d->tag;
             copy++;
             i = LEN(d->tag);
-            d->tag = (int) copy;
+            d->tag = (auint) copy;
             copy_elements (copy, obj, i);
             break;
 
@@ -1923,10 +2182,10 @@ extern size_t * gc_copy (size_t *obj) {
             print_indent ();
       printf ("gc_copy:string_tag; len = %d\n", LEN(d->tag) + 1); fflush (stdout);
 #endif
-            current += (LEN(d->tag) + sizeof(int)) / sizeof(size_t) + 1;
+            current += (LEN(d->tag) + sizeof(aint)) / sizeof(size_t) + 1;
             *copy = d->tag;
             copy++;
-            d->tag = (int) copy;
+            d->tag = (auint) copy;
             strcpy ((char*)&copy[0], (char*) obj);
             break;
 
@@ -1948,7 +2207,7 @@ extern size_t * gc_copy (size_t *obj) {
             copy++;
             *copy = d->tag;
             copy++;
-            d->tag = (int) copy;
+            d->tag = (auint) copy;
             copy_elements (copy, obj, i);
             break;
 
@@ -1972,17 +2231,338 @@ extern size_t * gc_copy (size_t *obj) {
     return copy;
 }
 
+/* ======================================== */
+/*           Parallel copying               */
+/* ======================================== */
+
+typedef struct {
+    size_t         *chunk_current;
+    size_t         *chunk_end;
+    pthread_mutex_t lock;
+    size_t        **grey;
+    size_t          grey_head;
+    size_t          grey_tail;
+    size_t          grey_capacity;
+    size_t          copied;  // words, for the statistics
+} gc_worker;
+
+static gc_worker gc_workers[MAX_GC_THREADS];
+static int       parallel_collection = 0;
+static int       gc_active_workers   = 0;
+static int       gc_idle_workers     = 0;
+
+// claims to-space for a copy of the given size in words, below the new objects in the incremental mode
+static size_t * gc_claim (gc_worker *w, size_t words) {
+    size_t *p     = w->chunk_current;
+    size_t *limit = gc_collecting ? high_begin : to_space.end;
+    if (p != NULL && p + words <= w->chunk_end) {
+        w->chunk_current += words;
+        return p;
+    }
+    // large objects get a chunk of their own
+    p = __atomic_fetch_add (&current, (words <= GC_LARGE_COPY ? GC_CHUNK_SIZE : words) * sizeof(size_t),
+                            __ATOMIC_RELAXED);
+    if (p + (words <= GC_LARGE_COPY ? GC_CHUNK_SIZE : words) > limit) {
+        perror ("ERROR: gc_claim: out-of-space\n");
+        exit (1);
+    }
+    if (words <= GC_LARGE_COPY) {
+        w->chunk_current = p + words;
+        w->chunk_end     = p + GC_CHUNK_SIZE;
+    }
+    return p;
+}
+
+static void gc_push_grey (gc_worker *w, size_t *obj) {
+    pthread_mutex_lock (&w->lock);
+    if (w->grey_tail == w->grey_capacity) {
+        if (w->grey_head > 0) {
+            memmove (w->grey, w->grey + w->grey_head, (w->grey_tail - w->grey_head) * sizeof(size_t*));
+            w->grey_tail -= w->grey_head;
+            w->grey_head  = 0;
+        } else {
+            w->grey_capacity = w->grey_capacity ? w->grey_capacity << 1 : 1024;
+            w->grey          = realloc (w->grey, w->grey_capacity * sizeof(size_t*));
+            if (w->grey == NULL) {
+                perror ("ERROR: gc_push_grey: realloc failed\n");
+                exit   (1);
+            }
+        }
+    }
+    w->grey[w->grey_tail++] = obj;
+    pthread_mutex_unlock (&w->lock);
+}
+
+// the owner takes the latest object, depth first, thieves take the oldest one
+static size_t * gc_take_grey (gc_worker *w, int steal) {
+    size_t *obj = NULL;
+    pthread_mutex_lock (&w->lock);
+    if (w->grey_head < w->grey_tail) {
+        obj = steal ? w->grey[w->grey_head++] : w->grey[--w->grey_tail];
+        if (w->grey_head == w->grey_tail) w->grey_head = w->grey_tail = 0;
+    }
+    pthread_mutex_unlock (&w->lock);
+    return obj;
+}
+
+// the header of an object being copied, no tag is even
+# define GC_BUSY_TAG 0
+
+// gc_copy of the parallel mode: copies the object itself, its fields are copied when it is taken from the grey set
+static size_t * gc_copy_shared (gc_worker *w, size_t *obj) {
+    data   *d      = TO_DATA(obj);
+    auint   tag    = __atomic_load_n (&d->tag, __ATOMIC_ACQUIRE);
+    size_t  words  = 0;
+    size_t  header = 1;
+    size_t *copy   = NULL;
+
+    // the thread that takes the header copies the object, the others wait for its forward pointer,
+    // so no to-space is claimed for copies that lose
+    for (;;) {
+        if (IS_FORWARD_PTR(tag)) return (size_t *) tag;
+        if (tag != GC_BUSY_TAG &&
+            __atomic_compare_exchange_n (&d->tag, &tag, GC_BUSY_TAG, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) break;
+        if (tag == GC_BUSY_TAG) tag = __atomic_load_n (&d->tag, __ATOMIC_ACQUIRE);
+    }
+
+    switch (TAG(tag)) {
+        case CLOSURE_TAG:
+        case ARRAY_TAG:
+            words = LEN(tag) + 1;
+            break;
+        case STRING_TAG:
+            words = (LEN(tag) + sizeof(aint)) / sizeof(size_t) + 1;
+            break;
+        case SEXP_TAG:
+            words  = LEN(tag) + 2;
+            header = 2;
+            break;
+        default:
+            perror ("ERROR: gc_copy_shared: weird tag");
+            exit (1);
+    }
+    copy = gc_claim (w, words);
+    memcpy (copy, obj - header, words * sizeof(size_t));
+    copy[header - 1] = tag;
+    __atomic_store_n (&d->tag, (auint) (copy + header), __ATOMIC_RELEASE);
+    w->copied += words;
+    if (TAG(tag) != STRING_TAG) gc_push_grey (w, copy + header);
+    return copy + header;
+}
+
+static void gc_scan_grey (gc_worker *w, size_t *obj) {
+    size_t len = LEN(TO_DATA(obj)->tag);
+    for (size_t i = 0; i < len; i++) {
+        if (IS_CONDEMNED(obj[i])) obj[i] = (size_t) gc_copy_shared (w, (size_t *) obj[i]);
+    }
+}
+
+static size_t * gc_steal_grey (gc_worker *w) {
+    size_t *obj = NULL;
+    int     n   = __atomic_load_n (&gc_active_workers, __ATOMIC_ACQUIRE);
+    for (int i = 1; i < n && obj == NULL; i++) {
+        obj = gc_take_grey (&gc_workers[(w - gc_workers + i) % n], 1);
+    }
+    return obj;
+}
+
+// copies the grey objects until all the threads have run out of them
+static void gc_drain_grey (gc_worker *w) {
+    size_t *obj = NULL;
+    for (;;) {
+        while ((obj = gc_take_grey (w, 0)) != NULL || (obj = gc_steal_grey (w)) != NULL) {
+            gc_scan_grey (w, obj);
+        }
+        // an idle thread has an empty deque and pushes nothing, so the work is over once all the threads are idle
+        __atomic_add_fetch (&gc_idle_workers, 1, __ATOMIC_ACQ_REL);
+        for (;;) {
+            if (__atomic_load_n (&gc_idle_workers, __ATOMIC_ACQUIRE) ==
+                __atomic_load_n (&gc_active_workers, __ATOMIC_ACQUIRE)) return;
+            if ((obj = gc_steal_grey (w)) != NULL) break;
+            sched_yield ();
+        }
+        __atomic_sub_fetch (&gc_idle_workers, 1, __ATOMIC_ACQ_REL);
+        gc_scan_grey (w, obj);
+    }
+}
+
+static void * gc_worker_thread (void *w) {
+    gc_drain_grey ((gc_worker *) w);
+    return NULL;
+}
+
+// starts a parallel collection unless the to-space can't have room for the unused ends of the chunks,
+// the collection copies sequentially then
+static int gc_parallel_begin (void) {
+    size_t live = (from_space.current - from_space.begin) + (nursery.current - nursery.begin);
+    while ((size_t) (to_space.end - to_space.begin) < GC_COPY_EXTENT(live, gc_threads)) {
+        if (extend_spaces ()) return 0;
+    }
+    for (int i = 0; i < gc_threads; i++) {
+        gc_workers[i].chunk_current = NULL;
+        gc_workers[i].chunk_end     = NULL;
+        gc_workers[i].grey_head     = 0;
+        gc_workers[i].grey_tail     = 0;
+        gc_workers[i].copied        = 0;
+    }
+    parallel_collection = 1;
+    return 1;
+}
+
+// copies the objects reachable from the roots, which the collecting thread has copied and made grey
+static void gc_parallel_finish (void) {
+    pthread_t threads[MAX_GC_THREADS];
+    int       started = 1;
+    gc_idle_workers   = 0;
+    gc_active_workers = gc_threads;
+    for (; started < gc_threads; started++) {
+        if (pthread_create (&threads[started], NULL, gc_worker_thread, &gc_workers[started])) {
+            // the threads that have started share the work
+            __atomic_store_n (&gc_active_workers, started, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    gc_drain_grey (&gc_workers[0]);
+    for (int i = 1; i < started; i++) pthread_join (threads[i], NULL);
+    for (int i = 0; i < gc_threads; i++) gc_stats.copied += gc_workers[i].copied;
+    parallel_collection = 0;
+}
+
+/* ======================================== */
+/*           Incremental copying            */
+/* ======================================== */
+
+// the allocation window of the mutator
+static size_t *alloc_current = NULL;
+static size_t *alloc_end     = NULL;
+// the to-space below it is kept for the copies
+static size_t *copy_reserve  = NULL;
+// words in use after the last collection
+static size_t  survived      = 0;
+// the grey object being scanned and its next field
+static size_t *scan_object   = NULL;
+static size_t  scan_index    = 0;
+
+extern void * gc_read_barrier (void *v) {
+    if (gc_collecting && IS_CONDEMNED(v)) return gc_copy_shared (&gc_workers[0], (size_t *) v);
+    return v;
+}
+
+// words of the from-space taken by objects: the ones at its bottom and the ones allocated at its top
+static size_t incremental_used (void) {
+    return (from_space.current - from_space.begin) + (from_space.end - high_begin);
+}
+
+static void gc_start_cycle (size_t size) {
+    uint64_t start = gc_clock ();
+    size_t   used  = incremental_used ();
+    // the to-space keeps at least as much room for new objects as for the copies, and the space grows
+    // when the objects that survived the last collection leave less than a quarter of it to the mutator
+    init_to_space (used > SPACE_SIZE / 2 || survived + size > SPACE_SIZE / 4);
+    // and has room for the copies with the unused ends of their chunks
+    while ((size_t) (to_space.end - to_space.begin) < GC_COPY_EXTENT(used, 1)) {
+        if (grown_space_size () == SPACE_SIZE) heap_limit_exceeded ();
+        free_pool (&to_space);
+        init_to_space (1);
+    }
+    copy_reserve = to_space.begin + GC_COPY_EXTENT(used, 1);
+    high_begin   = to_space.end;
+    current      = to_space.begin;
+    gc_workers[0].chunk_current = NULL;
+    gc_workers[0].chunk_end     = NULL;
+    gc_workers[0].grey_head     = 0;
+    gc_workers[0].grey_tail     = 0;
+    gc_workers[0].copied        = 0;
+    scan_object   = NULL;
+    alloc_current = NULL;
+    alloc_end     = NULL;
+    gc_collecting = 1;
+    gc_root_scan_data ();
+    gc_root_scan_program_stack ();
+    for (int i = 0; i < extra_roots.current_free; i++) {
+        gc_test_and_copy_root ((size_t**)extra_roots.roots[i]);
+    }
+    gc_stats.collections++;
+    gc_stats.condemned += used;
+    gc_pause (start);
+}
+
+// scans at most budget fields of grey objects, the collection ends when there are none left
+static void gc_step (size_t budget) {
+    gc_worker *w     = &gc_workers[0];
+    uint64_t   start = gc_clock ();
+    while (budget > 0) {
+        if (scan_object == NULL) {
+            scan_object = gc_take_grey (w, 0);
+            scan_index  = 0;
+            if (scan_object == NULL) {
+                gc_collecting = 0;
+                gc_swap_spaces ();
+                survived = incremental_used ();
+                gc_stats.copied += w->copied;
+                gc_pause (start);
+                return;
+            }
+        }
+        size_t len = LEN(TO_DATA(scan_object)->tag);
+        for (; scan_index < len && budget > 0; scan_index++, budget--) {
+            size_t elem = scan_object[scan_index];
+            if (IS_CONDEMNED(elem)) scan_object[scan_index] = (size_t) gc_copy_shared (w, (size_t *) elem);
+        }
+        if (scan_index == len) scan_object = NULL;
+    }
+    gc_pause (start);
+}
+
+// runtime functions walking the heap finish the collection first, as they read fields without the read barrier
+static void gc_finish_cycle (void) {
+    if (gc_collecting) gc_step (SIZE_MAX);
+}
+
+// alloc of the incremental mode, collections advance when the window is refilled
+static void * incremental_alloc (size_t size) {
+    void *p      = NULL;
+    int   cycles = 0;
+    while (alloc_current == NULL || alloc_current + size > alloc_end) {
+        if (gc_collecting) gc_step (gc_pause_budget);
+        if (gc_collecting) {
+            size_t window = size > gc_pause_budget ? size : gc_pause_budget;
+            if (high_begin > copy_reserve && (size_t) (high_begin - copy_reserve) >= window) {
+                high_begin   -= window;
+                alloc_current = high_begin;
+                alloc_end     = high_begin + window;
+                continue;
+            }
+            // no room left for new objects: the rest of the collection at once
+            gc_finish_cycle ();
+        }
+        // half of the space is left for the new objects of the next collection
+        if (incremental_used () + size <= SPACE_SIZE / 2) {
+            alloc_current      = from_space.current;
+            alloc_end          = from_space.begin + SPACE_SIZE / 2 - (from_space.end - high_begin);
+            from_space.current = alloc_end;
+        } else {
+            // the heap can't grow any more, and a second whole collection has left no room either
+            if (grown_space_size () == SPACE_SIZE && ++cycles > 2) heap_limit_exceeded ();
+            gc_start_cycle (size);
+        }
+    }
+    p = (void*) alloc_current;
+    alloc_current += size;
+    return p;
+}
+
 extern void gc_test_and_copy_root (size_t ** root) {
 #ifdef DEBUG_PRINT
     indent++;
 #endif
-    if (IS_VALID_HEAP_POINTER(*root)) {
+    if (IS_CONDEMNED(*root)) {
 #ifdef DEBUG_PRINT
         print_indent ();
     printf ("gc_test_and_copy_root: root %p top=%p bot=%p  *root %p \n", root, __gc_stack_top, __gc_stack_bottom, *root);
     fflush (stdout);
 #endif
-        *root = gc_copy (*root);
+        *root = parallel_collection || gc_collecting ? gc_copy_shared (&gc_workers[0], *root) : gc_copy (*root);
     }
 #ifdef DEBUG_PRINT
     else {
@@ -2006,13 +2586,35 @@ static inline void init_extra_roots (void) {
     extra_roots.current_free = 0;
 }
 
+// write barrier: records a slot of an old object set to a nursery object
+extern void gc_write_barrier (void **slot, void *v) {
+    if (!IN_NURSERY(v) || UNBOXED(v) || !IN_OLD_SPACE(slot)) return;
+    if (remembered.size == remembered.capacity) {
+        remembered.capacity = remembered.capacity ? remembered.capacity << 1 : 1024;
+        remembered.slots    = realloc (remembered.slots, remembered.capacity * sizeof(void**));
+        if (remembered.slots == NULL) {
+            perror ("ERROR: gc_write_barrier: realloc failed\n");
+            exit   (1);
+        }
+    }
+    remembered.slots[remembered.size++] = slot;
+}
+
+static void reset_nursery (void) {
+    nursery.current = nursery.begin;
+    remembered.size = 0;
+}
+
 extern void __init (void) {
     size_t space_size = SPACE_SIZE * sizeof(size_t);
 
     srandom (time (NULL));
 
+    if (SPACE_SIZE > max_space_size) SPACE_SIZE = max_space_size;
+    min_space_size   = SPACE_SIZE;
+    space_size       = SPACE_SIZE * sizeof(size_t);
     from_space.begin = mmap (NULL, space_size, PROT_READ | PROT_WRITE,
-                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
     to_space.begin   = NULL;
     if (from_space.begin == MAP_FAILED) {
         perror ("EROOR: init_pool: mmap failed\n");
@@ -2024,15 +2626,57 @@ extern void __init (void) {
     to_space.current   = NULL;
     to_space.end       = NULL;
     to_space.size      = 0;
+    high_begin         = from_space.end;
+    for (int i = 0; i < MAX_GC_THREADS; i++) pthread_mutex_init (&gc_workers[i].lock, NULL);
+    if (generational) {
+        nursery.begin = mmap (NULL, NURSERY_SIZE * sizeof(size_t), PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (nursery.begin == MAP_FAILED) {
+            perror ("EROOR: init_pool: mmap failed\n");
+            exit   (1);
+        }
+        nursery.current = nursery.begin;
+        nursery.end     = nursery.begin + NURSERY_SIZE;
+        nursery.size    = NURSERY_SIZE;
+        gc_inline_alloc.current   = &nursery.current;
+        gc_inline_alloc.end       = &nursery.end;
+        gc_inline_alloc.max_words = LARGE_OBJECT_SIZE;
+    }
+    if (incremental) {
+        gc_inline_alloc.current = &alloc_current;
+        gc_inline_alloc.end     = &alloc_end;
+    }
     init_extra_roots ();
+    init_stats ();
+}
+
+// resizes the heap after a full collection: the next to-space is larger when more than half of the
+// from-space is in use, and the unused top of the from-space is unmapped while less than an eighth is
+static void adapt_space_size (void) {
+    size_t live = from_space.current - from_space.begin;
+    size_t size = from_space.size;
+    if (live > SPACE_SIZE / 2) {
+        grow_space_size ();
+        return;
+    }
+    while (size / 2 >= min_space_size && live < size / 8) size /= 2;
+    if (size < from_space.size) {
+        munmap (from_space.begin + size, (from_space.size - size) * sizeof(size_t));
+        from_space.end  = from_space.begin + size;
+        from_space.size = size;
+        SPACE_SIZE      = size;
+    }
 }
 
 static void* gc (size_t size) {
+    size_t condemned = (from_space.current - from_space.begin) + (nursery.current - nursery.begin);
+
     if (! enable_GC) {
         Lfailure ("GC disabled");
     }
 
     current = to_space.begin;
+    if (gc_threads > 1) gc_parallel_begin ();
 #ifdef DEBUG_PRINT
     print_indent ();
   printf ("gc: current:%p; to_space.b =%p; to_space.e =%p; \
@@ -2046,7 +2690,7 @@ static void* gc (size_t size) {
     print_indent ();
   printf ("gc: data is scanned\n"); fflush (stdout);
 #endif
-    __gc_root_scan_stack ();
+    gc_root_scan_program_stack ();
     for (int i = 0; i < extra_roots.current_free; i++) {
 #ifdef DEBUG_PRINT
         print_indent ();
@@ -2060,6 +2704,9 @@ static void* gc (size_t size) {
     print_indent ();
   printf ("gc: no more extra roots\n"); fflush (stdout);
 #endif
+    if (parallel_collection) gc_parallel_finish ();
+    else gc_stats.copied += current - to_space.begin;
+    gc_stats.condemned += condemned;
 
     if (!IN_PASSIVE_SPACE(current)) {
         printf ("gc: ASSERT: !IN_PASSIVE_SPACE(current) to_begin = %p to_end = %p \
@@ -2076,6 +2723,7 @@ static void* gc (size_t size) {
     fflush (stdout);
 #endif
         if (extend_spaces ()) {
+            if (grown_space_size () == SPACE_SIZE) heap_limit_exceeded ();
             gc_swap_spaces ();
             init_to_space (1);
             return gc (size);
@@ -2090,7 +2738,9 @@ static void* gc (size_t size) {
     assert (current + size < to_space.end);
 
     gc_swap_spaces ();
+    reset_nursery ();
     from_space.current = current + size;
+    adapt_space_size ();
 #ifdef DEBUG_PRINT
     print_indent ();
   printf ("gc: end: (allocate!) return %p; from_space.current %p; \
@@ -2102,6 +2752,48 @@ static void* gc (size_t size) {
     return (void *) current;
 }
 
+// promotes the live nursery objects to the old space, or collects the whole heap
+// when the old space may have no room for them
+static void minor_gc (void) {
+    uint64_t start = gc_clock ();
+    size_t   used  = nursery.current - nursery.begin;
+
+    if (! enable_GC) {
+        Lfailure ("GC disabled");
+    }
+
+    if ((size_t) (from_space.end - from_space.current) <= used) {
+        // the to-space has room for the old space and the whole nursery
+        init_to_space (from_space.current - from_space.begin + used >= SPACE_SIZE);
+        if (from_space.current - from_space.begin + used > SPACE_SIZE) heap_limit_exceeded ();
+        // and the old space keeps room for the next minor collection
+        from_space.current = gc (NURSERY_SIZE);
+        gc_stats.collections++;
+        gc_pause (start);
+        return;
+    }
+
+    minor_collection = 1;
+    copy_space       = &from_space;
+    current          = from_space.current;
+    gc_root_scan_data ();
+    gc_root_scan_program_stack ();
+    for (int i = 0; i < extra_roots.current_free; i++) {
+        gc_test_and_copy_root ((size_t**)extra_roots.roots[i]);
+    }
+    for (size_t i = 0; i < remembered.size; i++) {
+        gc_test_and_copy_root ((size_t**)remembered.slots[i]);
+    }
+    gc_stats.minor_collections++;
+    gc_stats.condemned += used;
+    gc_stats.copied    += current - from_space.current;
+    from_space.current = current;
+    minor_collection   = 0;
+    copy_space         = &to_space;
+    reset_nursery ();
+    gc_pause (start);
+}
+
 #ifdef DEBUG_PRINT
 static void printFromSpace (void) {
   size_t * cur = from_space.begin, *tmp = NULL;
@@ -2123,14 +2815,14 @@ static void printFromSpace (void) {
 	      d->contents, d->contents,
 	      LEN(d->tag), LEN(d->tag) + 1 + sizeof(int));
       fflush (stdout);
-      len = (LEN(d->tag) + sizeof(int)) / sizeof(size_t) + 1;
+      len = (LEN(d->tag) + sizeof(aint)) / sizeof(size_t) + 1;
       break;
 
     case CLOSURE_TAG:
       printf ("(=>%p): CLOSURE\n\t", d->contents);
       len = LEN(d->tag);
       for (int i = 0; i < len; i++) {
-	int elem = ((int*)d->contents)[i];
+	aint elem = ((aint*)d->contents)[i];
 	if (UNBOXED(elem)) printf ("%d ", elem);
 	else printf ("%p ", elem);
       }
@@ -2143,7 +2835,7 @@ static void printFromSpace (void) {
       printf ("(=>%p): ARRAY\n\t", d->contents);
       len = LEN(d->tag);
       for (int i = 0; i < len; i++) {
-	int elem = ((int*)d->contents)[i];
+	aint elem = ((aint*)d->contents)[i];
 	if (UNBOXED(elem)) printf ("%d ", elem);
 	else printf ("%p ", elem);
       }
@@ -2160,7 +2852,7 @@ static void printFromSpace (void) {
       len = LEN(d->tag);
       tmp = (s->contents.contents);
       for (int i = 0; i < len; i++) {
-	int elem = ((int*)tmp)[i];
+	aint elem = ((aint*)tmp)[i];
 	if (UNBOXED(elem)) printf ("%d ", UNBOX(elem));
 	else printf ("%p ", elem);
       }
@@ -2193,13 +2885,37 @@ static void printFromSpace (void) {
 #ifdef __ENABLE_GC__
 // alloc: allocates `size` bytes in heap
 extern void * alloc (size_t size) {
-    void * p = (void*)BOX(NULL);
+    void *   p     = (void*)BOX(NULL);
+    uint64_t start = 0;
     size = (size - 1) / sizeof(size_t) + 1; // convert bytes to words
+    if (gc_stats_requested) {
+        gc_stats_requested = 0;
+        gc_stats_report ();
+    }
 #ifdef DEBUG_PRINT
     indent++; print_indent ();
   printf ("alloc: current: %p %zu words!", from_space.current, size);
   fflush (stdout);
 #endif
+    if (incremental) {
+#ifdef DEBUG_PRINT
+        indent--;
+#endif
+        return incremental_alloc (size);
+    }
+    if (generational) {
+        if (size <= LARGE_OBJECT_SIZE) {
+            if (nursery.current + size > nursery.end) minor_gc ();
+            p = (void*) nursery.current;
+            nursery.current += size;
+#ifdef DEBUG_PRINT
+            indent--;
+#endif
+            return p;
+        }
+        // a minor collection first, so that the object is filled with old pointers only
+        minor_gc ();
+    }
     if (from_space.current + size < from_space.end) {
         p = (void*) from_space.current;
         from_space.current += size;
@@ -2211,6 +2927,7 @@ extern void * alloc (size_t size) {
         return p;
     }
 
+    start = gc_clock ();
     init_to_space (0);
 #ifdef DEBUG_PRINT
     print_indent ();
@@ -2222,9 +2939,11 @@ extern void * alloc (size_t size) {
 	 from_space.end, from_space.current, p); fflush (stdout);
   printFromSpace(); fflush (stdout);
   indent--;
-  return p;
 #else
-    return gc (size);
+    p = gc (size);
 #endif
+    gc_stats.collections++;
+    gc_pause (start);
+    return p;
 }
 # endif
\ No newline at end of file
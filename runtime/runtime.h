@@ -12,9 +12,61 @@
 # include <time.h>
 # include <limits.h>
 # include <ctype.h>
+# include <stdint.h>
+# include <pthread.h>
 
 # define WORD_SIZE (CHAR_BIT * sizeof(int))
 
-void failure (char *s, ...);
+/* A word of Lama values, a boxed integer or a pointer: as wide as pointers of the build,
+   so boxed integers have 31 bits in 32-bit builds and 63 bits in 64-bit ones */
+typedef intptr_t  aint;
+typedef uintptr_t auint;
+
+void failure (char *s, ...) __attribute__ ((noreturn));
+
+/* Switches the GC to the generational mode, called before __gc_init */
+void gc_set_generational (void);
+/* Write barrier of the generational mode, called after a store of v to a slot of a heap object */
+void gc_write_barrier (void **slot, void *v);
+
+/* Precise roots: a program keeping its own stack frames may enumerate its roots itself, the scanner
+   calls visit on every slot holding a value instead of the conservative scan of the whole stack */
+typedef void (*gc_root_visitor) (size_t **root);
+void gc_set_root_scanner (void (*scanner) (gc_root_visitor visit));
+
+/* Hard limit of the heap size in bytes, called before __gc_init: a program whose live objects don't fit
+   fails instead of growing the heap further */
+void gc_set_heap_limit (size_t bytes);
+
+/* Number of threads copying the heap in full collections, 1 by default */
+void gc_set_threads (int n);
+
+/* Switches the GC to the incremental mode, called before __gc_init; the pause budget is the number
+   of fields copied per step */
+void gc_set_incremental (void);
+void gc_set_pause_budget (size_t words);
+/* Read barrier of the incremental mode, for values loaded from heap objects while a collection runs */
+extern int gc_collecting;
+void * gc_read_barrier (void *v);
+# define GC_READ_BARRIER(v) (gc_collecting ? gc_read_barrier (v) : (v))
+
+/* Inline allocation: the bump pointer of the space new objects are allocated in and its limit. An object
+   of at most max_words words may be allocated at *current when it ends below *end, moving *current past it
+   and adding its size in bytes to gc_allocated (by kind: strings, arrays, s-expressions and closures, indexed
+   by their tag >> 1); objects that don't fit are allocated by the runtime, which collects garbage */
+typedef struct {
+    size_t **current;
+    size_t **end;
+    size_t   max_words;
+} gc_alloc_region;
+extern gc_alloc_region gc_inline_alloc;
+extern size_t          gc_allocated[4];
+
+/* GC statistics (collections, allocated and copied bytes, pauses), printed to stderr at exit and by
+   the next alloc after SIGUSR1 when enabled, called before __gc_init; the LAMA_GC_STATS variable
+   (text or json) enables them too */
+# define GC_STATS_TEXT 1
+# define GC_STATS_JSON 2
+void gc_set_stats (int format);
 
 # endif
\ No newline at end of file
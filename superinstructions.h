@@ -0,0 +1,96 @@
+#pragma once
+
+#include "predecoder.h"
+
+/**
+ * Superinstructions for the most frequent instruction sequences reported by the static analyzer
+ * (see analyzer/Sort.bc.stats): pattern matching code is dominated by DUP; CONST; ELEM chains with ST; DROP
+ * bindings, and expressions load their operands with LD; LD. Loop and if conditions compare right before
+ * a conditional jump, the fused instruction branches on the comparison without boxing its result.
+ * Backward jumps of tiered execution are counting instructions and stay unfused (see tiering.h).
+ */
+typedef struct {
+    opcode fused;
+    u_int32_t length;
+    opcode sequence[3];
+} superinstruction;
+
+// longer sequences go first, so that they win over their prefixes
+static const superinstruction superinstructions[] = {
+        {OP_DUP_CONST_ELEM,          3, {OP_DUP,         OP_CONST, OP_ELEM}},
+        {OP_CONST_ELEM,              2, {OP_CONST,       OP_ELEM}},
+        {OP_ST_LOCAL_DROP,           2, {OP_ST_LOCAL,    OP_DROP}},
+        {OP_DROP_DROP,               2, {OP_DROP,        OP_DROP}},
+        {OP_DUP_DUP,                 2, {OP_DUP,         OP_DUP}},
+        {OP_LD_LOCAL_LD_LOCAL,       2, {OP_LD_LOCAL,    OP_LD_LOCAL}},
+        {OP_LD_LOCAL_LD_ARGUMENT,    2, {OP_LD_LOCAL,    OP_LD_ARGUMENT}},
+        {OP_LD_ARGUMENT_LD_LOCAL,    2, {OP_LD_ARGUMENT, OP_LD_LOCAL}},
+        {OP_LD_ARGUMENT_LD_ARGUMENT, 2, {OP_LD_ARGUMENT, OP_LD_ARGUMENT}},
+        {OP_LESS_CJMP_Z,             2, {OP_BINOP_LESS,  OP_CJMP_Z}},
+        {OP_LESS_CJMP_NZ,            2, {OP_BINOP_LESS,  OP_CJMP_NZ}},
+        {OP_LESS_EQUAL_CJMP_Z,       2, {OP_BINOP_LESS_EQUAL, OP_CJMP_Z}},
+        {OP_LESS_EQUAL_CJMP_NZ,      2, {OP_BINOP_LESS_EQUAL, OP_CJMP_NZ}},
+        {OP_GREATER_CJMP_Z,          2, {OP_BINOP_GREATER, OP_CJMP_Z}},
+        {OP_GREATER_CJMP_NZ,         2, {OP_BINOP_GREATER, OP_CJMP_NZ}},
+        {OP_GREATER_EQUAL_CJMP_Z,    2, {OP_BINOP_GREATER_EQUAL, OP_CJMP_Z}},
+        {OP_GREATER_EQUAL_CJMP_NZ,   2, {OP_BINOP_GREATER_EQUAL, OP_CJMP_NZ}},
+        {OP_EQUAL_CJMP_Z,            2, {OP_BINOP_EQUAL, OP_CJMP_Z}},
+        {OP_EQUAL_CJMP_NZ,           2, {OP_BINOP_EQUAL, OP_CJMP_NZ}},
+        {OP_NOT_EQUAL_CJMP_Z,        2, {OP_BINOP_NOT_EQUAL, OP_CJMP_Z}},
+        {OP_NOT_EQUAL_CJMP_NZ,       2, {OP_BINOP_NOT_EQUAL, OP_CJMP_NZ}},
+};
+
+static inline bool is_compare_jump(u_int32_t opcode) {
+    return opcode >= OP_LESS_CJMP_Z && opcode <= OP_NOT_EQUAL_CJMP_NZ;
+}
+
+static bool matches_superinstruction(const decoded_program *program, u_int32_t i, u_int32_t last,
+                                     const superinstruction *s) {
+    if (i + s->length > last) {
+        return false;
+    }
+    for (u_int32_t j = 0; j < s->length; ++j) {
+        if (program->code[i + j].opcode != s->sequence[j]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// replaces the first instruction of every matched sequence in [first, last) with its superinstruction
+void select_superinstructions(decoded_program *program, u_int32_t first, u_int32_t last) {
+    u_int32_t i = first;
+    while (i < last) {
+        const superinstruction *matched = NULL;
+        for (size_t k = 0; k < sizeof(superinstructions) / sizeof(superinstruction); ++k) {
+            if (matches_superinstruction(program, i, last, &superinstructions[k])) {
+                matched = &superinstructions[k];
+                break;
+            }
+        }
+        if (matched == NULL) {
+            ++i;
+            continue;
+        }
+        instruction *first = &program->code[i];
+        switch (matched->fused) {
+            case OP_DUP_CONST_ELEM:
+                first->arg1 = program->code[i + 1].arg1;
+                break;
+            case OP_LD_LOCAL_LD_LOCAL:
+            case OP_LD_LOCAL_LD_ARGUMENT:
+            case OP_LD_ARGUMENT_LD_LOCAL:
+            case OP_LD_ARGUMENT_LD_ARGUMENT:
+                first->arg2 = program->code[i + 1].arg1;
+                break;
+            case OP_LESS_CJMP_Z ... OP_NOT_EQUAL_CJMP_NZ:
+                first->arg1 = program->code[i + 1].arg1;
+                break;
+            default:
+                // the operand of the first instruction is the only one
+                break;
+        }
+        first->opcode = matched->fused;
+        i += matched->length;
+    }
+}
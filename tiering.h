@@ -0,0 +1,101 @@
+#pragma once
+
+#include <limits.h>
+#include "superinstructions.h"
+#include "interpreter.h"
+#include "jit.h"
+
+/**
+ * Tiered execution.
+ * BEGIN and backward jumps of every function are replaced with counting variants, which add the invocations
+ * and loop iterations of the function up in function_info.hotness. When the count reaches the threshold
+ * of the next tier, the function is promoted:
+ *   tier 0  plain pre-decoded instructions,
+ *   tier 1  superinstructions selected in the code of the function,
+ *   tier 2  compiled by the JIT; frames of the function that are still interpreted continue in compiled
+ *           code at their next back edge.
+ * Short runs don't pay for optimizing code that never gets hot, long runs still reach compiled code.
+ */
+
+typedef struct {
+    bool enabled;
+    u_int32_t superinstructions_threshold;
+    u_int32_t jit_threshold;
+    bool superinstructions;
+    // compilation is possible: the program is verified and checks are not forced
+    bool jit;
+} tiering_options;
+
+#define DEFAULT_SUPERINSTRUCTIONS_THRESHOLD 100
+#define DEFAULT_JIT_THRESHOLD 1000
+static const u_int32_t NEVER = UINT_MAX;
+
+static tiering_options tiering = {
+        .superinstructions_threshold = DEFAULT_SUPERINSTRUCTIONS_THRESHOLD,
+        .jit_threshold = DEFAULT_JIT_THRESHOLD,
+        .superinstructions = true,
+};
+
+// index after the last instruction of the function
+static u_int32_t function_end(const decoded_program *program, u_int32_t function) {
+    return function + 1 < program->functions_number ? program->functions[function + 1].entry : program->length;
+}
+
+void tier_up(u_int32_t function) {
+    decoded_program *program = interpreterState.program;
+    function_info *f = &program->functions[function];
+    switch (f->tier) {
+        case 0:
+            if (tiering.superinstructions) {
+                u_int32_t end = function_end(program, function);
+                select_superinstructions(program, f->entry, end);
+#ifdef __GNUC__
+                if (threaded_handlers != NULL) {
+                    for (u_int32_t i = f->entry; i < end; ++i) {
+                        program->code[i].handler = threaded_handlers[program->code[i].opcode];
+                    }
+                }
+#endif
+            }
+            f->tier = 1;
+            f->next_tier = tiering.jit ? tiering.jit_threshold : NEVER;
+            break;
+        case 1:
+            f->tier = 2;
+            // with the zero threshold every back edge of an interpreted frame enters the compiled code
+            f->next_tier = jit_compile_function(program, function) ? 0 : NEVER;
+            break;
+    }
+}
+
+// replaces entries and backward jumps with their counting variants
+void tiering_init(decoded_program *program) {
+    for (u_int32_t function = 0; function < program->functions_number; ++function) {
+        function_info *f = &program->functions[function];
+        f->hotness = 0;
+        f->tier = 0;
+        f->next_tier = tiering.superinstructions_threshold;
+        u_int32_t end = function_end(program, function);
+        program->code[f->entry].opcode = OP_BEGIN_COUNTED;
+        for (u_int32_t i = f->entry; i < end; ++i) {
+            instruction *insn = &program->code[i];
+            if (insn->arg1 > i) {
+                continue;
+            }
+            switch (insn->opcode) {
+                case OP_JMP:
+                    insn->opcode = OP_JMP_BACK;
+                    insn->arg2 = function;
+                    break;
+                case OP_CJMP_Z:
+                    insn->opcode = OP_CJMP_Z_BACK;
+                    insn->arg2 = function;
+                    break;
+                case OP_CJMP_NZ:
+                    insn->opcode = OP_CJMP_NZ_BACK;
+                    insn->arg2 = function;
+                    break;
+            }
+        }
+    }
+}
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include "predecoder.h"
+
+/**
+ * Load-time bytecode verifier.
+ * Walks the control flow of every function from its BEGIN and checks that
+ *   - the operand stack has the same depth on every path into an instruction and never underflows,
+ *   - global, local, argument, closure and string table indices are in range,
+ *   - jumps stay inside their function, CALL and CLOSURE target a BEGIN, CALL passes the expected arguments.
+ * On success it stores in decoded_program.functions the number of virtual stack words each frame may use,
+ * so that the interpreter can replace the checks of every push and pop with a single check at BEGIN.
+ *
+ * STA takes two or three values depending on whether its destination is a reference pushed by LDA,
+ * so besides the depth the verifier tracks which of the top VERIFIER_TRACKED_SLOTS slots hold such references.
+ * Must run before select_superinstructions().
+ */
+
+#define VERIFIER_TRACKED_SLOTS 64
+#define VERIFIER_MAX_DEPTH (1 << 20)
+
+typedef struct {
+    u_int32_t depth;
+    u_int64_t references; // bit i is set when the i-th slot from the top was pushed by LDA
+} stack_state;
+
+typedef struct {
+    const decoded_program *program;
+    stack_state *states;        // state before each reached instruction
+    u_int32_t *owners;          // function of each reached instruction
+    u_int32_t *captures_number; // number of captured values of each function, NOT_AN_INSTRUCTION if not a closure
+    bool *called;               // whether the function is a CALL target
+    u_int32_t *worklist;
+    u_int32_t worklist_size;
+} verifier;
+
+// reason of the last rejected program
+static char verification_error[256];
+
+static bool reject(const verifier *v, u_int32_t index, const char *format, ...) {
+    int length = snprintf(verification_error, sizeof(verification_error), "instruction %u (%s): ", index,
+                          opcode_names[v->program->code[index].opcode]);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(verification_error + length, sizeof(verification_error) - length, format, args);
+    va_end(args);
+    return false;
+}
+
+static bool is_function_entry(const decoded_program *program, u_int32_t target) {
+    return target < program->length && program->code[target].opcode == OP_BEGIN;
+}
+
+static bool verify_location(const verifier *v, u_int32_t index, u_int32_t function, u_int8_t loc, u_int32_t value) {
+    const function_info *f = &v->program->functions[function];
+    switch (loc) {
+        case GLOBAL:
+            if (value >= v->program->byteFile->global_area_size) {
+                return reject(v, index, "global %u out of %u", value, v->program->byteFile->global_area_size);
+            }
+            return true;
+        case LOCAL:
+            if (value >= f->n_locals) {
+                return reject(v, index, "local %u out of %u", value, f->n_locals);
+            }
+            return true;
+        case ARGUMENT:
+            // pre-decoding counted arguments from the last one, out of range indices wrap around
+            if (value >= f->n_args) {
+                return reject(v, index, "argument %u out of %u", f->n_args - 1 - value, f->n_args);
+            }
+            return true;
+        case CLOJURE:
+            if (v->captures_number[function] == NOT_AN_INSTRUCTION) {
+                return reject(v, index, "captured value %u outside of a closure", value);
+            }
+            if (value >= v->captures_number[function]) {
+                return reject(v, index, "captured value %u out of %u", value, v->captures_number[function]);
+            }
+            return true;
+        default:
+            return reject(v, index, "invalid location %u", loc);
+    }
+}
+
+static bool verify_string(const verifier *v, u_int32_t index, auint string) {
+    const byte_file *bf = v->program->byteFile;
+    if (string - (auint) bf->string_ptr >= bf->string_table_size) {
+        return reject(v, index, "string out of the string table");
+    }
+    return true;
+}
+
+// passes state from instruction index to instruction target of the same function
+static bool flow(verifier *v, u_int32_t function, u_int32_t index, u_int32_t target, stack_state state) {
+    if (target >= v->program->length) {
+        return reject(v, index, "control falls off the end of the code");
+    }
+    if (v->program->code[target].opcode == OP_BEGIN) {
+        return reject(v, index, "control reaches BEGIN at %u", target);
+    }
+    if (state.depth > VERIFIER_MAX_DEPTH) {
+        return reject(v, index, "operand stack deeper than %u", VERIFIER_MAX_DEPTH);
+    }
+    if (v->owners[target] == NOT_AN_INSTRUCTION) {
+        v->owners[target] = function;
+        v->states[target] = state;
+        v->worklist[v->worklist_size++] = target;
+    } else if (v->owners[target] != function) {
+        return reject(v, index, "jump to %u into another function", target);
+    } else if (v->states[target].depth != state.depth || v->states[target].references != state.references) {
+        return reject(v, index, "operand stack differs on paths into %u", target);
+    }
+    function_info *f = &v->program->functions[function];
+    if (state.depth > f->frame_size) {
+        f->frame_size = state.depth;
+    }
+    return true;
+}
+
+static bool pop_values(const verifier *v, u_int32_t index, stack_state *state, u_int32_t count) {
+    if (state->depth < count) {
+        return reject(v, index, "operand stack underflow");
+    }
+    state->depth -= count;
+    state->references = count < VERIFIER_TRACKED_SLOTS ? state->references >> count : 0;
+    return true;
+}
+
+static bool push_value(const verifier *v, u_int32_t index, stack_state *state, bool reference) {
+    if (state->references >> (VERIFIER_TRACKED_SLOTS - 1)) {
+        return reject(v, index, "reference is too deep in the operand stack");
+    }
+    state->depth++;
+    state->references = (state->references << 1) | reference;
+    return true;
+}
+
+// a tail call reuses the frame, so an LDA reference to its slots among the operands turns it into a plain call
+static void demote_tail_call(const verifier *v, u_int32_t index, stack_state state, u_int32_t operands) {
+    u_int64_t mask = operands < VERIFIER_TRACKED_SLOTS ? ((u_int64_t) 1 << operands) - 1 : ~(u_int64_t) 0;
+    instruction *insn = &v->program->code[index];
+    if ((state.references & mask) != 0) {
+        insn->opcode = insn->opcode == OP_TAIL_CALL ? OP_CALL : insn->opcode == OP_TAIL_CALLC ? OP_CALLC
+                                                                                             : insn->opcode;
+    }
+}
+
+// checks operands of the instruction and computes the state after it, returns false on rejection
+static bool verify_instruction(verifier *v, u_int32_t function, u_int32_t index) {
+    const decoded_program *program = v->program;
+    const instruction *insn = &program->code[index];
+    stack_state state = v->states[index];
+    switch (insn->opcode) {
+        case OP_BINOP_PLUS ... OP_BINOP_OR:
+        case OP_PATT_STR:
+        case OP_ELEM:
+            return pop_values(v, index, &state, 2) && push_value(v, index, &state, false)
+                   && flow(v, function, index, index + 1, state);
+        case OP_LD_GLOBAL ... OP_LDA_CLOJURE:
+            return verify_location(v, index, function, (insn->opcode - OP_LD_GLOBAL) % 4, insn->arg1)
+                   && push_value(v, index, &state, insn->opcode >= OP_LDA_GLOBAL)
+                   && flow(v, function, index, index + 1, state);
+        case OP_ST_GLOBAL ... OP_ST_CLOJURE:
+            return verify_location(v, index, function, insn->opcode - OP_ST_GLOBAL, insn->arg1)
+                   && pop_values(v, index, &state, 1) && push_value(v, index, &state, false)
+                   && flow(v, function, index, index + 1, state);
+        case OP_PATT_TAG_STR ... OP_PATT_TAG_CLOSURE:
+        case OP_CALL_WRITE:
+        case OP_CALL_STRING:
+        case OP_CALL_LENGTH:
+        case OP_ARRAY:
+        case OP_TAG:
+            return pop_values(v, index, &state, 1) && push_value(v, index, &state, false)
+                   && flow(v, function, index, index + 1, state);
+        case OP_CONST:
+        case OP_CALL_READ:
+            return push_value(v, index, &state, false) && flow(v, function, index, index + 1, state);
+        case OP_STRING:
+            return verify_string(v, index, insn->arg1)
+                   && push_value(v, index, &state, false) && flow(v, function, index, index + 1, state);
+        case OP_SEXP:
+            return pop_values(v, index, &state, insn->arg2) && push_value(v, index, &state, false)
+                   && flow(v, function, index, index + 1, state);
+        case OP_CALL_ARRAY:
+            return pop_values(v, index, &state, insn->arg1) && push_value(v, index, &state, false)
+                   && flow(v, function, index, index + 1, state);
+        case OP_STA: {
+            // assignment through a reference takes the value and the reference, otherwise value, index and array
+            bool through_reference = (state.references >> 1) & 1;
+            return pop_values(v, index, &state, through_reference ? 2 : 3) && push_value(v, index, &state, false)
+                   && flow(v, function, index, index + 1, state);
+        }
+        case OP_JMP:
+            return flow(v, function, index, insn->arg1, state);
+        case OP_CJMP_Z:
+        case OP_CJMP_NZ:
+            return pop_values(v, index, &state, 1) && flow(v, function, index, insn->arg1, state)
+                   && flow(v, function, index, index + 1, state);
+        case OP_BEGIN:
+            return flow(v, function, index, index + 1, state);
+        case OP_CALL:
+        case OP_TAIL_CALL: {
+            demote_tail_call(v, index, state, insn->arg2);
+            if (!is_function_entry(program, insn->arg1)) {
+                return reject(v, index, "call target %u is not a BEGIN", (u_int32_t) insn->arg1);
+            }
+            u_int32_t callee = program->code[insn->arg1].arg1;
+            if (program->functions[callee].n_args != insn->arg2) {
+                return reject(v, index, "%u arguments passed to a function of %u", insn->arg2,
+                              program->functions[callee].n_args);
+            }
+            return pop_values(v, index, &state, insn->arg2) && push_value(v, index, &state, false)
+                   && flow(v, function, index, index + 1, state);
+        }
+        case OP_CALLC:
+        case OP_TAIL_CALLC:
+            demote_tail_call(v, index, state, insn->arg1 + 1);
+            // arguments and the closure, the callee is checked at run time
+            return pop_values(v, index, &state, insn->arg1 + 1) && push_value(v, index, &state, false)
+                   && flow(v, function, index, index + 1, state);
+        case OP_CLOSURE: {
+            const u_int32_t *captures = program->captures + insn->arg2;
+            for (u_int32_t i = 0; i < captures[0]; ++i) {
+                if (!verify_location(v, index, function, captures[2 * i + 1], captures[2 * i + 2])) {
+                    return false;
+                }
+            }
+            return push_value(v, index, &state, false) && flow(v, function, index, index + 1, state);
+        }
+        case OP_DROP:
+            return pop_values(v, index, &state, 1) && flow(v, function, index, index + 1, state);
+        case OP_DUP: {
+            bool reference = state.references & 1;
+            return pop_values(v, index, &state, 1) && push_value(v, index, &state, reference)
+                   && push_value(v, index, &state, reference) && flow(v, function, index, index + 1, state);
+        }
+        case OP_SWAP: {
+            bool top = state.references & 1;
+            bool second = (state.references >> 1) & 1;
+            return pop_values(v, index, &state, 2) && push_value(v, index, &state, top)
+                   && push_value(v, index, &state, second) && flow(v, function, index, index + 1, state);
+        }
+        case OP_LINE:
+            return flow(v, function, index, index + 1, state);
+        case OP_END:
+            return pop_values(v, index, &state, 1);
+        case OP_FAIL:
+        case OP_STI:
+        case OP_RET:
+        case OP_STOP:
+            // fail at run time
+            return true;
+        default:
+            return reject(v, index, "unexpected opcode");
+    }
+}
+
+// collects the number of captured values of closures and checks CLOSURE targets
+static bool collect_closures(verifier *v) {
+    const decoded_program *program = v->program;
+    for (u_int32_t i = 0; i < program->length; ++i) {
+        const instruction *insn = &program->code[i];
+        if ((insn->opcode == OP_CALL || insn->opcode == OP_TAIL_CALL) && is_function_entry(program, insn->arg1)) {
+            v->called[program->code[insn->arg1].arg1] = true;
+        }
+        if (insn->opcode != OP_CLOSURE) {
+            continue;
+        }
+        if (!is_function_entry(program, insn->arg1)) {
+            return reject(v, i, "closure target %u is not a BEGIN", (u_int32_t) insn->arg1);
+        }
+        u_int32_t function = program->code[insn->arg1].arg1;
+        u_int32_t captures_number = program->captures[insn->arg2];
+        if (v->captures_number[function] != NOT_AN_INSTRUCTION && v->captures_number[function] != captures_number) {
+            return reject(v, i, "closures of one function capture %u and %u values",
+                          v->captures_number[function], captures_number);
+        }
+        v->captures_number[function] = captures_number;
+    }
+    for (u_int32_t f = 0; f < program->functions_number; ++f) {
+        if (v->called[f] && v->captures_number[f] != NOT_AN_INSTRUCTION) {
+            return reject(v, program->functions[f].entry, "closure called directly");
+        }
+    }
+    return true;
+}
+
+static bool verify_functions(verifier *v) {
+    const decoded_program *program = v->program;
+    if (!collect_closures(v)) {
+        return false;
+    }
+    for (u_int32_t f = 0; f < program->functions_number; ++f) {
+        v->owners[program->functions[f].entry] = f;
+    }
+    for (u_int32_t f = 0; f < program->functions_number; ++f) {
+        function_info *function = &program->functions[f];
+        function->frame_size = 0;
+        v->states[function->entry] = (stack_state) {0, 0};
+        v->worklist[0] = function->entry;
+        v->worklist_size = 1;
+        while (v->worklist_size > 0) {
+            if (!verify_instruction(v, f, v->worklist[--v->worklist_size])) {
+                return false;
+            }
+        }
+        // the saved frame pointer, locals, the operand stack with the cached top placeholder
+        // and the return address and the number of arguments pushed by calls
+        function->frame_size += 1 + function->n_locals + 1 + 2;
+    }
+    return true;
+}
+
+// verifies the program, on failure leaves the reason in verification_error
+bool verify_program(decoded_program *program) {
+    if (program->length == 0 || program->code[0].opcode != OP_BEGIN) {
+        snprintf(verification_error, sizeof(verification_error), "the code doesn't start with BEGIN");
+        return false;
+    }
+    verifier v = {
+            .program = program,
+            .states = malloc(program->length * sizeof(stack_state)),
+            .owners = malloc(program->length * sizeof(u_int32_t)),
+            .captures_number = malloc((program->functions_number + 1) * sizeof(u_int32_t)),
+            .called = calloc(program->functions_number + 1, sizeof(bool)),
+            .worklist = malloc(program->length * sizeof(u_int32_t)),
+            .worklist_size = 0,
+    };
+    if (v.states == NULL || v.owners == NULL || v.captures_number == NULL || v.called == NULL || v.worklist == NULL) {
+        failure("Severity ERROR: Can't allocate memory.\n");
+    }
+    for (u_int32_t i = 0; i < program->length; ++i) {
+        v.owners[i] = NOT_AN_INSTRUCTION;
+    }
+    for (u_int32_t f = 0; f < program->functions_number; ++f) {
+        v.captures_number[f] = NOT_AN_INSTRUCTION;
+    }
+    bool verified = verify_functions(&v);
+    free(v.states);
+    free(v.owners);
+    free(v.captures_number);
+    free(v.called);
+    free(v.worklist);
+    program->verified = verified;
+    return verified;
+}